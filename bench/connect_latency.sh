@@ -0,0 +1,65 @@
+#!/bin/sh
+#-------------------------------------------------------------------------
+#
+# connect_latency.sh
+#
+# Connection establishment benchmark of passwordpolicy.
+#
+# Starts a throwaway cluster without and with passwordpolicy in
+# shared_preload_libraries, then with p_policy.max_failed_logins set too,
+# and lets pgbench open a new connection for every transaction. Sessions
+# never set a password; what the module adds to a connection is its
+# ClientAuthentication_hook, which returns at once unless the lockout is
+# enabled, and then looks the role and its address up in shared memory.
+#
+#   make install
+#   bench/connect_latency.sh [seconds] [clients]
+#
+# Copyright (c) 2018, indrajit
+#
+#-------------------------------------------------------------------------
+set -e
+
+SECONDS_PER_RUN=${1:-10}
+CLIENTS=${2:-8}
+PORT=${PGBENCH_PORT:-54329}
+
+PATH="$(pg_config --bindir):$PATH"
+DATA=$(mktemp -d)
+
+cleanup() {
+  pg_ctl -D "$DATA" -m immediate stop >/dev/null 2>&1 || true
+  rm -rf "$DATA"
+}
+trap cleanup EXIT
+
+initdb -D "$DATA" -A trust >/dev/null
+echo 'SELECT 1;' >"$DATA/select.sql"
+: >"$DATA/summary"
+
+# run name shared_preload_libraries [options]
+run() {
+  pg_ctl -D "$DATA" -w -l "$DATA/server.log" \
+    -o "-p $PORT -k $DATA -c listen_addresses='' -c shared_preload_libraries='$2' $3" \
+    start >/dev/null
+  echo "$1:"
+  pgbench -h "$DATA" -p "$PORT" -n -C -c "$CLIENTS" -j "$CLIENTS" \
+    -T "$SECONDS_PER_RUN" -f "$DATA/select.sql" postgres |
+    grep -E 'average connection time|^tps' | tee "$DATA/run"
+  pg_ctl -D "$DATA" -w stop >/dev/null
+  sed -n "s/^average connection time = \([0-9.]*\) ms/| $1 | \1 ms |/p" \
+    "$DATA/run" >>"$DATA/summary"
+}
+
+run "without passwordpolicy" ""
+run "with passwordpolicy" "passwordpolicy"
+run "with passwordpolicy and lockout" "passwordpolicy" \
+  "-c p_policy.max_failed_logins=5"
+
+# ready to be recorded in the README
+echo
+echo "$(postgres --version), $CLIENTS clients, $SECONDS_PER_RUN s per run:"
+echo
+echo "| | average connection time |"
+echo "|---|---|"
+cat "$DATA/summary"
@@ -0,0 +1,106 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_bench.c
+ *
+ * Throughput benchmark of the standalone passwordpolicy code.
+ *
+ * Generates a synthetic corpus and runs it through the validator,
+ * reporting generation and validation rates and the verdicts per kind.
+ *
+ *   make bench
+ *   bench/pp_bench [seed] [count]
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pp_corpus.h"
+#include "pp_validate.h"
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 10) : 42;
+  long count = argc > 2 ? strtol(argv[2], NULL, 10) : 1000000;
+  PPPolicy policy = {.min_length = 8,
+                     .min_special = 2,
+                     .min_numbers = 2,
+                     .min_upper = 2,
+                     .min_lower = 2};
+  long verdicts[PP_CORPUS_NUM_KINDS][PP_NUM_RULES];
+  PPCorpusKind *kinds;
+  PPCorpus corpus;
+  PPStream stream;
+  char buf[PP_CORPUS_MAX_LEN];
+  char *passwords;
+  size_t *lengths;
+  size_t bytes = 0;
+  double start, elapsed;
+  long i;
+  int k, r;
+
+  passwords = malloc((size_t)count * PP_CORPUS_MAX_LEN);
+  lengths = malloc((size_t)count * sizeof(size_t));
+  kinds = malloc((size_t)count * sizeof(PPCorpusKind));
+  if (passwords == NULL || lengths == NULL || kinds == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  memset(verdicts, 0, sizeof(verdicts));
+
+  /*
+   * time the generator alone, writing every password to the same buffer,
+   * so the rate doesn't depend on the memory bandwidth of the machine
+   */
+  pp_corpus_init(&corpus, seed);
+  start = now();
+  for (i = 0; i < count; i++) {
+    bytes += pp_corpus_next(&corpus, buf, NULL);
+  }
+  elapsed = now() - start;
+  printf("generate: %ld passwords, %.1f MB/s\n", count,
+         bytes / elapsed / 1e6);
+
+  /* the same corpus again, kept for the validator */
+  pp_corpus_init(&corpus, seed);
+  for (i = 0; i < count; i++) {
+    lengths[i] = pp_corpus_next(&corpus, passwords + i * PP_CORPUS_MAX_LEN,
+                                &kinds[i]);
+  }
+
+  pp_stream_init(&stream, &policy, "alice", NULL, 0);
+  start = now();
+  for (i = 0; i < count; i++) {
+    pp_stream_reset(&stream);
+    pp_stream_append(&stream, passwords + i * PP_CORPUS_MAX_LEN, lengths[i]);
+    verdicts[kinds[i]][pp_stream_verdict(&stream)]++;
+  }
+  elapsed = now() - start;
+  printf("validate: %.0f passwords/s, %.1f MB/s\n", count / elapsed,
+         bytes / elapsed / 1e6);
+
+  for (k = 0; k < PP_CORPUS_NUM_KINDS; k++) {
+    printf("%-14s", pp_corpus_kind_name((PPCorpusKind)k));
+    for (r = 0; r < PP_NUM_RULES; r++) {
+      if (verdicts[k][r] > 0) {
+        printf(" %s=%ld", pp_rule_name((PPRule)r), verdicts[k][r]);
+      }
+    }
+    printf("\n");
+  }
+
+  free(passwords);
+  free(lengths);
+  free(kinds);
+  return 0;
+}
@@ -0,0 +1,183 @@
+/* passwordpolicy--1.0.0--1.1.0.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION passwordpolicy UPDATE TO '1.1.0'" to load this file. \quit
+
+-- Number of passwords the enforced and the shadow policy judged with each
+-- rule. The "ok" row counts accepted passwords.
+CREATE FUNCTION passwordpolicy_stats(
+    OUT rule text,
+    OUT enforced int8,
+    OUT shadow int8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'passwordpolicy_stats'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW passwordpolicy_stats AS
+  SELECT * FROM passwordpolicy_stats();
+
+-- What every stage of check_password does with a candidate password.
+CREATE FUNCTION passwordpolicy_explain(
+    password text,
+    username text,
+    OUT stage text,
+    OUT ran bool,
+    OUT verdict text,
+    OUT time_us float8,
+    OUT bytes_scanned int8,
+    OUT cache_tier text,
+    OUT probes int8,
+    OUT lists text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'passwordpolicy_explain'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+-- Deterministic synthetic passwords for benchmarks and tests.
+CREATE FUNCTION passwordpolicy_corpus(
+    seed int8,
+    count int4,
+    OUT kind text,
+    OUT password text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'passwordpolicy_corpus'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- Event counters, such as random secrets accepted through the fast path.
+CREATE FUNCTION passwordpolicy_counters(
+    OUT name text,
+    OUT value int8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'passwordpolicy_counters'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW passwordpolicy_counters AS
+  SELECT * FROM passwordpolicy_counters();
+
+-- Denylists and their words, managed with passwordpolicy_list_set,
+-- passwordpolicy_list_drop, passwordpolicy_deny_add and
+-- passwordpolicy_deny_remove. The worker loads them into shared memory at
+-- startup. The id of a list is its bit in the shared index.
+CREATE TABLE @extschema@.passwordpolicy_lists (
+    name text PRIMARY KEY,
+    id int4 NOT NULL UNIQUE CHECK (id BETWEEN 0 AND 31),
+    action text NOT NULL CHECK (action IN ('reject', 'warn')));
+
+INSERT INTO @extschema@.passwordpolicy_lists VALUES ('default', 0, 'reject');
+
+CREATE TABLE @extschema@.passwordpolicy_denylist (
+    word text NOT NULL,
+    list text NOT NULL DEFAULT 'default'
+        REFERENCES @extschema@.passwordpolicy_lists (name) ON DELETE CASCADE,
+    added_at timestamptz NOT NULL DEFAULT now(),
+    PRIMARY KEY (word, list));
+
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.passwordpolicy_lists', 'WHERE name <> ''default''');
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.passwordpolicy_denylist', '');
+
+CREATE FUNCTION passwordpolicy_deny_add(word text, list text DEFAULT 'default')
+RETURNS bool
+AS 'MODULE_PATHNAME', 'passwordpolicy_deny_add'
+LANGUAGE C STRICT VOLATILE PARALLEL UNSAFE;
+
+CREATE FUNCTION passwordpolicy_deny_remove(word text, list text DEFAULT 'default')
+RETURNS bool
+AS 'MODULE_PATHNAME', 'passwordpolicy_deny_remove'
+LANGUAGE C STRICT VOLATILE PARALLEL UNSAFE;
+
+-- action is 'reject' or 'warn'
+CREATE FUNCTION passwordpolicy_list_set(list text, action text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'passwordpolicy_list_set'
+LANGUAGE C STRICT VOLATILE PARALLEL UNSAFE;
+
+CREATE FUNCTION passwordpolicy_list_drop(list text)
+RETURNS bool
+AS 'MODULE_PATHNAME', 'passwordpolicy_list_drop'
+LANGUAGE C STRICT VOLATILE PARALLEL UNSAFE;
+
+-- Words and hits of every denylist.
+CREATE FUNCTION passwordpolicy_list_stats(
+    OUT list text,
+    OUT action text,
+    OUT words int8,
+    OUT hits int8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'passwordpolicy_list_stats'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW passwordpolicy_list_stats AS
+  SELECT * FROM passwordpolicy_list_stats();
+
+REVOKE ALL ON @extschema@.passwordpolicy_lists FROM PUBLIC;
+REVOKE ALL ON @extschema@.passwordpolicy_denylist FROM PUBLIC;
+REVOKE ALL ON FUNCTION passwordpolicy_deny_add(text, text) FROM PUBLIC;
+REVOKE ALL ON FUNCTION passwordpolicy_deny_remove(text, text) FROM PUBLIC;
+REVOKE ALL ON FUNCTION passwordpolicy_list_set(text, text) FROM PUBLIC;
+REVOKE ALL ON FUNCTION passwordpolicy_list_drop(text) FROM PUBLIC;
+
+-- Size and residency of the structures of passwordpolicy, with their
+-- limits; NULL where a value is unknown or there is no limit.
+CREATE FUNCTION passwordpolicy_memory(
+    OUT structure text,
+    OUT kind text,
+    OUT size_bytes int8,
+    OUT size_limit int8,
+    OUT resident_bytes int8,
+    OUT entries int8,
+    OUT entries_limit int8,
+    OUT generation int8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'passwordpolicy_memory'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW passwordpolicy_memory AS
+  SELECT * FROM passwordpolicy_memory();
+
+-- Lifts the lockout of a role after failed logins, or only from address.
+CREATE FUNCTION passwordpolicy_unlock(role text, address text DEFAULT NULL)
+RETURNS bool
+AS 'MODULE_PATHNAME', 'passwordpolicy_unlock'
+LANGUAGE C VOLATILE PARALLEL UNSAFE;
+
+REVOKE ALL ON FUNCTION passwordpolicy_unlock(text, text) FROM PUBLIC;
+
+-- Checks password for role like check_password and returns its
+-- SCRAM-SHA-256 verifier, to be set with ALTER ROLE ... PASSWORD.
+CREATE FUNCTION passwordpolicy_scram_verifier(password text, role name)
+RETURNS text
+AS 'MODULE_PATHNAME', 'passwordpolicy_scram_verifier'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+-- Checks every password of a JSON array of {"role": ..., "password": ...}
+-- objects, then creates the missing roles with LOGIN and sets the
+-- passwords of the others; with dry_run, only returns the verdicts.
+CREATE FUNCTION passwordpolicy_provision_roles(
+    roles jsonb,
+    dry_run bool DEFAULT false,
+    OUT role text,
+    OUT action text,
+    OUT verdict text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'passwordpolicy_provision_roles'
+LANGUAGE C STRICT VOLATILE PARALLEL UNSAFE;
+
+REVOKE ALL ON FUNCTION passwordpolicy_provision_roles(jsonb, bool) FROM PUBLIC;
+
+-- Last password change of every role, written by the worker and loaded
+-- into shared memory at startup for p_policy.min_password_age.
+CREATE TABLE @extschema@.passwordpolicy_password_changes (
+    role name PRIMARY KEY,
+    changed_at timestamptz NOT NULL);
+
+SELECT pg_catalog.pg_extension_config_dump('@extschema@.passwordpolicy_password_changes', '');
+
+REVOKE ALL ON @extschema@.passwordpolicy_password_changes FROM PUBLIC;
+
+-- Login roles expiring within p_policy.expiry_warning_days, kept up to date
+-- by the worker, which notifies passwordpolicy_expiring of new ones.
+CREATE TABLE @extschema@.passwordpolicy_expiring_roles (
+    role name PRIMARY KEY,
+    valid_until timestamptz NOT NULL,
+    noticed_at timestamptz NOT NULL);
+
+REVOKE ALL ON @extschema@.passwordpolicy_expiring_roles FROM PUBLIC;
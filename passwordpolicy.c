@@ -28,26 +28,56 @@
  *-------------------------------------------------------------------------
  */
 
-#include <ctype.h>
 #include "postgres.h"
 #include "catalog/namespace.h"
+#include "common/string.h"
 #include "utils/guc.h"
 #include "commands/user.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
 #include "libpq/crypt.h"
 #include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/jsonb.h"
+#include "utils/timestamp.h"
 
-#if PG_VERSION_NUM < 100000
-#include "libpq/md5.h"
+/* InitMaterializedSRF, shmem_request_hook and custom WAL resource managers */
+#if PG_VERSION_NUM < 150000
+#error "passwordpolicy requires PostgreSQL 15 or later"
+#endif
+
+#include "common/scram-common.h"
+#if PG_VERSION_NUM >= 160000
+#include "libpq/scram.h"
+#endif
+
+#if PG_VERSION_NUM >= 160000
+#define PP_SCRAM_SALT_LEN SCRAM_SHA_256_DEFAULT_SALT_LEN
+#else
+#define PP_SCRAM_SALT_LEN SCRAM_DEFAULT_SALT_LEN
 #endif
 
 #ifdef USE_CRACKLIB
 #include <crack.h>
 #endif
 
+#include "passwordpolicy.h"
+#include "pp_corpus.h"
+
 PG_MODULE_MAGIC;
 
 extern void _PG_init(void);
 
+PG_FUNCTION_INFO_V1(passwordpolicy_explain);
+PG_FUNCTION_INFO_V1(passwordpolicy_corpus);
+PG_FUNCTION_INFO_V1(passwordpolicy_scram_verifier);
+PG_FUNCTION_INFO_V1(passwordpolicy_provision_roles);
+
 // p_policy.min_password_len
 int passMinLength = 8;
 
@@ -63,6 +93,116 @@ int passMinUpperChar = 2;
 // p_policy.min_lowercase_letter
 int passMinLowerChar = 2;
 
+// p_policy.min_distinct_chars
+int passMinDistinctChar = 6;
+
+// p_policy.min_class_transitions
+int passMinTransitions = 0;
+
+// p_policy.max_repeat_share
+double passMaxRepeatShare = 0.5;
+
+// p_policy.forbidden_substrings
+char *passForbidden = NULL;
+
+// p_policy.shadow_enabled
+bool passShadowEnabled = false;
+
+// p_policy.shadow_min_password_len
+int passShadowMinLength = 8;
+
+// p_policy.shadow_min_special_chars
+int passShadowMinSpcChar = 2;
+
+// p_policy.shadow_min_numbers
+int passShadowMinNumChar = 2;
+
+// p_policy.shadow_min_uppercase_letter
+int passShadowMinUpperChar = 2;
+
+// p_policy.shadow_min_lowercase_letter
+int passShadowMinLowerChar = 2;
+
+// p_policy.shadow_min_distinct_chars
+int passShadowMinDistinctChar = 6;
+
+// p_policy.shadow_min_class_transitions
+int passShadowMinTransitions = 0;
+
+// p_policy.shadow_max_repeat_share
+double passShadowMaxRepeatShare = 0.5;
+
+// p_policy.fast_path_min_entropy
+double passFastPathMinEntropy = 128.0;
+
+// p_policy.metrics_port
+int passMetricsPort = 0;
+
+// p_policy.metrics_listen_address
+char *passMetricsListenAddress = NULL;
+
+// p_policy.metrics_socket
+char *passMetricsSocket = NULL;
+
+// p_policy.database
+char *passDatabase = NULL;
+
+// p_policy.hot_tier_interval
+int passHotTierInterval = 10;
+
+// p_policy.hot_tier_size
+int passHotTierSize = PP_HOT_TIER_SIZE;
+
+// p_policy.hot_tier_dump_interval
+int passHotTierDumpInterval = 300;
+
+// p_policy.denylist_max_words
+int passDenylistMaxWords = 0;
+
+// p_policy.backend_memory_limit
+int passBackendMemoryLimit = 0;
+
+// p_policy.max_failed_logins
+int passMaxFailedLogins = 0;
+
+// p_policy.lockout_duration
+int passLockoutDuration = 600;
+
+// p_policy.fuzzy_max_distance
+int passFuzzyMaxDistance = 0;
+
+// p_policy.min_password_age
+int passMinPasswordAge = 0;
+
+// p_policy.max_tracked_roles
+int passMaxTrackedRoles = 10000;
+
+// p_policy.max_valid_days
+int passMaxValidDays = 0;
+
+// p_policy.expiry_warning_days
+int passExpiryWarningDays = 7;
+
+// p_policy.expiry_check_interval
+int passExpiryCheckInterval = 3600;
+
+// p_policy.wal_log_changes
+bool passWalLogChanges = false;
+
+/* parsed p_policy.forbidden_substrings, kept as the GUC's extra */
+typedef struct ForbiddenList {
+  int count;
+  char words[PP_MAX_FORBIDDEN][PP_MAX_PATTERN_LEN + 1];
+} ForbiddenList;
+
+static ForbiddenList *passForbiddenList = NULL;
+
+/*
+ * set while passwordpolicy_provision_roles sets verifiers of passwords it
+ * already checked
+ */
+static bool prevalidated = false;
+
 /*
  * check_password
  *
@@ -76,67 +216,643 @@ int passMinLowerChar = 2;
  * validuntil_time: password expiration time, as a timestamptz Datum
  * validuntil_null: true if password expiration time is NULL
  *
- * This sample implementation doesn't pay any attention to the password
- * expiration time, but you might wish to insist that it be non-null and
- * not too far in the future.
+ * With p_policy.max_valid_days set, the expiration time must be non-null
+ * and not too far in the future.
  */
 
-static void check_policy(const char *password) {
-  int i, pwdlen, letter_count, number_count, spc_char_count, upper_count, lower_count;
+/*
+ * rule_message
+ *
+ * returns the message for a rule rejecting the password
+ */
+static char *rule_message(PPRule rule) {
+  switch (rule) {
+  case PP_RULE_LENGTH:
+    return pstrdup("password is too short.");
+  case PP_RULE_USERNAME:
+    return pstrdup("password must not contain user name.");
+  case PP_RULE_FORBIDDEN:
+    return pstrdup("password must not contain forbidden words.");
+  case PP_RULE_NUMBERS:
+    return psprintf("password must contain atleast %d numeric characters.",
+                    passMinNumChar);
+  case PP_RULE_SPECIAL:
+    return psprintf("password must contain atleast %d special characters.",
+                    passMinSpcChar);
+  case PP_RULE_UPPER:
+    return psprintf("password must contain atleast %d upper case letters.",
+                    passMinUpperChar);
+  case PP_RULE_LOWER:
+    return psprintf("password must contain atleast %d lower case letters.",
+                    passMinLowerChar);
+  case PP_RULE_DISTINCT:
+    return psprintf("password must contain atleast %d different characters.",
+                    passMinDistinctChar);
+  case PP_RULE_TRANSITIONS:
+    return psprintf("password must change between character classes "
+                    "atleast %d times.",
+                    passMinTransitions);
+  case PP_RULE_REPEAT:
+    return psprintf("password must not repeat a character in more "
+                    "than %g%% of its length.",
+                    passMaxRepeatShare * 100);
+  case PP_RULE_DENYLIST:
+    return pstrdup("password must not contain denied words.");
+  case PP_RULE_CRACKLIB:
+    return pstrdup("password is easily cracked.");
+  default:
+    elog(ERROR, "unrecognized password rule: %d.", rule);
+    break;
+  }
+  return NULL;
+}
+
+/*
+ * report_rule
+ *
+ * ereport's the error for a rule rejecting the password
+ */
+static void report_rule(PPRule rule) {
+  if (rule == PP_RULE_OK) {
+    return;
+  }
 
-  pwdlen = strlen(password);
+  ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                  errmsg("%s", rule_message(rule))));
+}
 
-  letter_count = 0;
-  number_count = 0;
-  spc_char_count = 0;
-  upper_count = 0;
-  lower_count = 0;
+static void current_policy(PPPolicy *policy) {
+  policy->min_length = passMinLength;
+  policy->min_special = passMinSpcChar;
+  policy->min_numbers = passMinNumChar;
+  policy->min_upper = passMinUpperChar;
+  policy->min_lower = passMinLowerChar;
+  policy->min_distinct = passMinDistinctChar;
+  policy->min_transitions = passMinTransitions;
+  policy->max_repeat_share = passMaxRepeatShare;
+}
 
-  for (i = 0; i < pwdlen; i++) {
-    /*
-     * isalpha() does not work for multibyte encodings but let's
-     * consider non-ASCII characters non-letters
-     */
-    if (isalpha((unsigned char)password[i])) {
-      letter_count++;
-      if (isupper((unsigned char)password[i])) {
-        upper_count++;
-      } else if (islower((unsigned char)password[i])) {
-        lower_count++;
+/*
+ * check_policy
+ *
+ * runs the length, user name, forbidden substring and character class
+ * rules in a single pass over the password, leaving what it found in
+ * features
+ */
+static PPRule check_policy(const char *username, const char *password,
+                           PPFeatures *features) {
+  PPPolicy policy;
+  PPStream stream;
+  const char *forbidden[PP_MAX_FORBIDDEN];
+  int nforbidden = 0;
+  PPRule rule;
+  int i;
+
+  current_policy(&policy);
+  if (passForbiddenList != NULL) {
+    for (i = 0; i < passForbiddenList->count; i++) {
+      forbidden[nforbidden++] = passForbiddenList->words[i];
+    }
+  }
+
+  pp_stream_init(&stream, &policy, username, forbidden, nforbidden);
+  pp_stream_append(&stream, password, strlen(password));
+  rule = pp_stream_verdict(&stream);
+  pp_stream_entropy(&stream);
+  *features = stream.features;
+  features->random_secret =
+      pp_is_random_secret(features, passFastPathMinEntropy);
+  return rule;
+}
+
+/* records the outcome of a stage that started at start */
+static void end_stage(PPStageResult *result, instr_time start, PPRule verdict,
+                      int64 bytes) {
+  instr_time duration;
+
+  INSTR_TIME_SET_CURRENT(duration);
+  INSTR_TIME_SUBTRACT(duration, start);
+
+  result->ran = true;
+  result->verdict = verdict;
+  result->time_us = INSTR_TIME_GET_DOUBLE(duration) * 1000000.0;
+  result->bytes = bytes;
+}
+
+/* runs the stages after saslprep, see run_pipeline */
+static PPRule run_stages(const char *username, const char *password,
+                         PPFeatures *features, PPStageResult *results,
+                         bool observe) {
+  int64 pwdlen = strlen(password);
+  instr_time start;
+  PPRule rule;
+
+  INSTR_TIME_SET_CURRENT(start);
+  rule = check_policy(username, password, features);
+  end_stage(&results[PP_STAGE_POLICY], start, rule, pwdlen);
+  if (rule != PP_RULE_OK) {
+    return rule;
+  }
+
+  /*
+   * A machine generated secret is not in any dictionary, don't spend time
+   * looking for it there.
+   */
+  if (features->random_secret) {
+    return PP_RULE_OK;
+  }
+
+  /* one probe per substring answers for every denylist */
+  if (pp_denylist_ready()) {
+    PPStageResult *result = &results[PP_STAGE_DENYLIST];
+
+    INSTR_TIME_SET_CURRENT(start);
+    pp_denylist_check(password, observe, result);
+    rule = pp_denylist_verdict(result->lists);
+    end_stage(result, start, rule, pwdlen);
+    if (rule != PP_RULE_OK) {
+      return rule;
+    }
+
+    /* typos of denied words, only once the exact probes found nothing */
+    if (passFuzzyMaxDistance > 0) {
+      result = &results[PP_STAGE_FUZZY];
+      INSTR_TIME_SET_CURRENT(start);
+      pp_fuzzy_check(password, result);
+      rule = pp_denylist_verdict(result->lists);
+      end_stage(result, start, rule, pwdlen);
+      if (rule != PP_RULE_OK) {
+        return rule;
       }
-    } else if (isdigit((unsigned char)password[i])) {
-      number_count++;
+    }
+  }
+
+#ifdef USE_CRACKLIB
+  /* call cracklib to check password */
+  INSTR_TIME_SET_CURRENT(start);
+  rule = FascistCheck(password, CRACKLIB_DICTPATH) ? PP_RULE_CRACKLIB
+                                                   : PP_RULE_OK;
+  end_stage(&results[PP_STAGE_CRACKLIB], start, rule, pwdlen);
+#endif
+
+  return rule;
+}
+
+/*
+ * run_pipeline
+ *
+ * runs the stages over a plaintext password until one of them rejects it,
+ * judging the password and user name the way SCRAM sees them
+ *
+ * features: receives what the policy stage found in the password
+ * results: receives the outcome of every stage, indexed by PPStage
+ * observe: whether the check counts towards the statistics
+ * prepped_out: if not NULL, receives the password as it was checked,
+ *			either password itself or a palloc'd copy the caller must
+ *			zero and free
+ *
+ * returns the rule that rejected the password, or PP_RULE_OK
+ */
+static PPRule run_pipeline(const char *username, const char *password,
+                           PPFeatures *features, PPStageResult *results,
+                           bool observe, const char **prepped_out) {
+  const char *prepped = password;
+  const char *prepped_username = username;
+  instr_time start;
+  PPRule rule;
+
+  memset(results, 0, sizeof(PPStageResult) * PP_NUM_STAGES);
+
+  /* pp_saslprep leaves pure ASCII alone, don't time that */
+  if (!pg_is_ascii(password) || !pg_is_ascii(username)) {
+    INSTR_TIME_SET_CURRENT(start);
+    prepped = pp_saslprep(password);
+    prepped_username = pp_saslprep(username);
+    end_stage(&results[PP_STAGE_SASLPREP], start, PP_RULE_OK,
+              strlen(password));
+  }
+  if (observe && prepped != password) {
+    pp_count(PP_COUNTER_SASLPREP);
+  }
+
+  rule = run_stages(prepped_username, prepped, features, results, observe);
+
+  if (prepped_out != NULL) {
+    *prepped_out = prepped;
+  } else if (prepped != password) {
+    explicit_bzero((char *)prepped, strlen(prepped));
+    pfree((char *)prepped);
+  }
+
+  pp_memory_enforce();
+  return rule;
+}
+
+/*
+ * judge_plaintext_password
+ *
+ * checks a plaintext password and accounts for the verdict; prepped_out is
+ * as for run_pipeline and is only set if the password is accepted
+ *
+ * returns the rule that rejected the password, or PP_RULE_OK
+ */
+static PPRule judge_plaintext_password(const char *username,
+                                       const char *password,
+                                       const char **prepped_out) {
+  PPStageResult results[PP_NUM_STAGES];
+  PPFeatures features;
+  const char *prepped = NULL;
+  PPRule rule;
+  int i;
+
+  rule = run_pipeline(username, password, &features, results, true,
+                      prepped_out != NULL ? &prepped : NULL);
+  for (i = 0; i < PP_NUM_STAGES; i++) {
+    if (results[i].ran) {
+      pp_observe_stage((PPStage)i, (uint64)results[i].time_us);
+    }
+  }
+  pp_denylist_report(
+      results[PP_STAGE_DENYLIST].lists | results[PP_STAGE_FUZZY].lists,
+      rule == PP_RULE_OK);
+  pp_count_verdict(rule);
+
+  if (rule != PP_RULE_OK) {
+    if (prepped_out != NULL && prepped != password) {
+      /* don't leave the rejected password lying around in memory */
+      explicit_bzero((char *)prepped, strlen(prepped));
+      pfree((char *)prepped);
+    }
+    return rule;
+  }
+
+  if (features.random_secret) {
+    pp_count(PP_COUNTER_FAST_PATH);
+  }
+
+  /* let the worker judge the accepted password by the shadow policy */
+  pp_shadow_enqueue(&features);
+
+  if (prepped_out != NULL) {
+    *prepped_out = prepped;
+  }
+  return PP_RULE_OK;
+}
+
+/*
+ * check_plaintext_password
+ *
+ * For unencrypted passwords we can perform better checks
+ */
+static void check_plaintext_password(const char *username,
+                                     const char *password) {
+  report_rule(judge_plaintext_password(username, password, NULL));
+}
+
+/*
+ * build_scram_verifier
+ *
+ * returns the SCRAM-SHA-256 verifier of a SASLprep'd password with a
+ * random salt
+ */
+static char *build_scram_verifier(const char *prepped) {
+  char salt[PP_SCRAM_SALT_LEN];
+  const char *errstr = NULL;
+  char *verifier;
+
+  if (!pg_strong_random(salt, sizeof(salt))) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("could not generate random salt.")));
+  }
+#if PG_VERSION_NUM >= 160000
+  verifier = scram_build_secret(PG_SHA256, SCRAM_SHA_256_KEY_LEN, salt,
+                                sizeof(salt), scram_sha_256_iterations,
+                                prepped, &errstr);
+#else
+  verifier = scram_build_secret(salt, sizeof(salt), SCRAM_DEFAULT_ITERATIONS,
+                                prepped, &errstr);
+#endif
+  if (verifier == NULL) {
+    elog(ERROR, "could not build SCRAM verifier: %s.", errstr);
+  }
+  return verifier;
+}
+
+/* zeroes and frees a password handed out by run_pipeline */
+static void free_prepped(const char *prepped, const char *password) {
+  if (prepped != NULL && prepped != password) {
+    explicit_bzero((char *)prepped, strlen(prepped));
+    pfree((char *)prepped);
+  }
+}
+
+/*
+ * passwordpolicy_scram_verifier
+ *
+ * checks a password for a role like check_password would and returns its
+ * SCRAM-SHA-256 verifier, built from the SASLprep'd password the checks
+ * already computed
+ */
+Datum passwordpolicy_scram_verifier(PG_FUNCTION_ARGS) {
+  char *password = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  const char *role = NameStr(*PG_GETARG_NAME(1));
+  const char *prepped = NULL;
+  PPRule rule;
+  char *verifier;
+
+  rule = judge_plaintext_password(role, password, &prepped);
+  if (rule != PP_RULE_OK) {
+    explicit_bzero(password, strlen(password));
+    report_rule(rule);
+  }
+
+  verifier = build_scram_verifier(prepped);
+  free_prepped(prepped, password);
+  explicit_bzero(password, strlen(password));
+
+  PG_RETURN_TEXT_P(cstring_to_text(verifier));
+}
+
+/* a role of passwordpolicy_provision_roles */
+typedef struct PPProvision {
+  char *role;
+  char *password;
+  const char *prepped;
+  bool exists;
+  bool duplicate;
+  PPRule rule;
+} PPProvision;
+
+/* returns the string member key of element index of the roles */
+static char *json_member(JsonbContainer *object, const char *key, int index) {
+  JsonbValue value;
+
+  if (getKeyJsonValueFromContainer(object, key, strlen(key), &value) == NULL ||
+      value.type != jbvString) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("role %d must have a string member \"%s\".",
+                           index + 1, key)));
+  }
+  return pnstrdup(value.val.string.val, value.val.string.len);
+}
+
+/*
+ * creates or alters a role, check_password skips the prevalidated verifier;
+ * with p_policy.max_valid_days set the password expires as late as allowed
+ */
+static void provision_role(PPProvision *p) {
+  char *verifier = build_scram_verifier(p->prepped);
+  TimestampTz valid_until = pp_expiry_limit();
+  char *sql;
+  int ret;
+
+  sql = psprintf(p->exists ? "ALTER ROLE %s PASSWORD %s"
+                           : "CREATE ROLE %s LOGIN PASSWORD %s",
+                 quote_identifier(p->role), quote_literal_cstr(verifier));
+  if (valid_until != 0) {
+    sql = psprintf("%s VALID UNTIL %s", sql,
+                   quote_literal_cstr(timestamptz_to_str(valid_until)));
+  }
+
+  prevalidated = true;
+  PG_TRY();
+  {
+    ret = SPI_execute(sql, false, 0);
+  }
+  PG_FINALLY();
+  {
+    prevalidated = false;
+  }
+  PG_END_TRY();
+
+  if (ret != SPI_OK_UTILITY) {
+    elog(ERROR, "SPI_execute failed: error code %d.", ret);
+  }
+}
+
+/*
+ * passwordpolicy_provision_roles
+ *
+ * checks the passwords of a JSON array of {"role": ..., "password": ...}
+ * objects and, if all of them are acceptable, creates the roles that don't
+ * exist with LOGIN and sets the passwords of the others; reports every
+ * unacceptable password and every role listed twice in a single error
+ *
+ * dry_run: only return the verdicts, without counting them or changing
+ *			any role
+ */
+Datum passwordpolicy_provision_roles(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  Jsonb *roles = PG_GETARG_JSONB_P(0);
+  bool dry_run = PG_GETARG_BOOL(1);
+  PPProvision *batch;
+  HASHCTL info;
+  HTAB *names;
+  StringInfoData violations;
+  int nviolations = 0;
+  int n;
+  int i;
+
+  if (!JB_ROOT_IS_ARRAY(roles) || JB_ROOT_IS_SCALAR(roles)) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("roles must be a JSON array.")));
+  }
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  n = JB_ROOT_COUNT(roles);
+  batch = (PPProvision *)palloc0(sizeof(PPProvision) * Max(n, 1));
+  initStringInfo(&violations);
+
+  memset(&info, 0, sizeof(info));
+  info.keysize = NAMEDATALEN;
+  info.entrysize = NAMEDATALEN;
+  info.hcxt = CurrentMemoryContext;
+  names = hash_create("passwordpolicy provisioned roles", Max(n, 1), &info,
+                      HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+
+  /* check every password before touching any role */
+  for (i = 0; i < n; i++) {
+    PPProvision *p = &batch[i];
+    JsonbValue *element = getIthJsonbValueFromContainer(&roles->root, i);
+
+    if (element == NULL || element->type != jbvBinary ||
+        !JsonContainerIsObject(element->val.binary.data)) {
+      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                      errmsg("role %d must be a JSON object.", i + 1)));
+    }
+    p->role = json_member(element->val.binary.data, "role", i);
+    p->password = json_member(element->val.binary.data, "password", i);
+    if (p->role[0] == '\0' || strlen(p->role) >= NAMEDATALEN) {
+      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                      errmsg("role names must be 1 to %d bytes long.",
+                             NAMEDATALEN - 1)));
+    }
+    p->exists = OidIsValid(get_role_oid(p->role, true));
+
+    /* a second CREATE ROLE would fail, only the first entry is checked */
+    (void)hash_search(names, p->role, HASH_ENTER, &p->duplicate);
+    if (p->duplicate) {
+      appendStringInfo(&violations, "%s%s: role is listed more than once.",
+                       nviolations > 0 ? "\n" : "", p->role);
+      nviolations++;
+      continue;
+    }
+
+    if (dry_run) {
+      PPStageResult results[PP_NUM_STAGES];
+      PPFeatures features;
+
+      p->rule = run_pipeline(p->role, p->password, &features, results, false,
+                             NULL);
     } else {
-      spc_char_count++;
+      p->rule = judge_plaintext_password(p->role, p->password, &p->prepped);
+    }
+
+    if (p->rule != PP_RULE_OK) {
+      appendStringInfo(&violations, "%s%s: %s", nviolations > 0 ? "\n" : "",
+                       p->role, rule_message(p->rule));
+      nviolations++;
+    }
+  }
+
+  if (!dry_run && nviolations > 0) {
+    for (i = 0; i < n; i++) {
+      free_prepped(batch[i].prepped, batch[i].password);
+      explicit_bzero(batch[i].password, strlen(batch[i].password));
     }
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("%d of %d roles are not acceptable.",
+                           nviolations, n),
+                    errdetail("%s", violations.data)));
+  }
+
+  if (!dry_run) {
+    SPI_connect();
+    for (i = 0; i < n; i++) {
+      provision_role(&batch[i]);
+      free_prepped(batch[i].prepped, batch[i].password);
+    }
+    SPI_finish();
+  }
+
+  for (i = 0; i < n; i++) {
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+
+    explicit_bzero(batch[i].password, strlen(batch[i].password));
+    values[0] = CStringGetTextDatum(batch[i].role);
+    values[1] = CStringGetTextDatum(batch[i].exists ? "alter" : "create");
+    values[2] = CStringGetTextDatum(
+        batch[i].duplicate ? "duplicate" : pp_rule_name(batch[i].rule));
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
   }
-  if (number_count < passMinNumChar) {
-    ereport(ERROR,
-            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-             errmsg("password must contain atleast %d numeric characters.",
-                    passMinNumChar)));
-  } else if (spc_char_count < passMinSpcChar) {
-    ereport(ERROR,
-            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-             errmsg("password must contain atleast %d special characters.",
-                    passMinSpcChar)));
-  } else if (upper_count < passMinUpperChar) {
-    ereport(ERROR,
-            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-             errmsg("password must contain atleast %d upper case letters.",
-                    passMinUpperChar)));
-  } else if (lower_count < passMinLowerChar) {
-    ereport(ERROR,
-            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-             errmsg("password must contain atleast %d lower case letters.",
-                    passMinLowerChar)));
+
+  return (Datum)0;
+}
+
+/*
+ * passwordpolicy_explain
+ *
+ * runs the pipeline over a candidate password like check_password would,
+ * but returns what every stage did instead of raising an error
+ */
+Datum passwordpolicy_explain(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  char *password = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  char *username = text_to_cstring(PG_GETARG_TEXT_PP(1));
+  PPStageResult results[PP_NUM_STAGES];
+  PPFeatures features;
+  int i;
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  (void)run_pipeline(username, password, &features, results, false, NULL);
+
+  for (i = 0; i < PP_NUM_STAGES; i++) {
+    PPStageResult *result = &results[i];
+    Datum values[8];
+    bool nulls[8] = {false, false, false, false, false, false, false, false};
+    char *lists;
+
+    values[0] = CStringGetTextDatum(pp_stage_name((PPStage)i));
+    values[1] = BoolGetDatum(result->ran);
+    if (result->ran) {
+      values[2] = CStringGetTextDatum(pp_rule_name(result->verdict));
+      values[3] = Float8GetDatum(result->time_us);
+      values[4] = Int64GetDatum(result->bytes);
+    } else {
+      nulls[2] = nulls[3] = nulls[4] = true;
+    }
+    if (result->cache_tier != NULL) {
+      values[5] = CStringGetTextDatum(result->cache_tier);
+    } else {
+      nulls[5] = true;
+    }
+    if (result->ran && result->probes > 0) {
+      values[6] = Int64GetDatum(result->probes);
+    } else {
+      nulls[6] = true;
+    }
+    lists = pp_denylist_names(result->lists);
+    if (lists != NULL) {
+      values[7] = CStringGetTextDatum(lists);
+    } else {
+      nulls[7] = true;
+    }
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
   }
+
+  /* don't leave the candidate lying around in memory */
+  explicit_bzero(password, strlen(password));
+
+  return (Datum)0;
+}
+
+/*
+ * passwordpolicy_corpus
+ *
+ * returns count synthetic passwords generated from seed
+ */
+Datum passwordpolicy_corpus(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  int64 seed = PG_GETARG_INT64(0);
+  int32 count = PG_GETARG_INT32(1);
+  char password[PP_CORPUS_MAX_LEN];
+  PPCorpus corpus;
+  int32 i;
+
+  InitMaterializedSRF(fcinfo, 0);
+
+  pp_corpus_init(&corpus, (uint64)seed);
+  for (i = 0; i < count; i++) {
+    PPCorpusKind kind;
+    Datum values[2];
+    bool nulls[2] = {false, false};
+
+    (void)pp_corpus_next(&corpus, password, &kind);
+    values[0] = CStringGetTextDatum(pp_corpus_kind_name(kind));
+    values[1] = CStringGetTextDatum(password);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
 }
 
-#if PG_VERSION_NUM >= 100000
 static void check_password(const char *username, const char *shadow_pass,
                            PasswordType password_type, Datum validuntil_time,
                            bool validuntil_null) {
+  pp_expiry_check(validuntil_time, validuntil_null);
+
+  /* provisioning its own role doesn't let a role change it too early */
+  pp_age_check(username);
+
+  /* passwordpolicy_provision_roles checked the password already */
+  if (prevalidated) {
+    pp_age_record(username);
+    return;
+  }
+
   if (password_type != PASSWORD_TYPE_PLAINTEXT) {
     /*
      * Unfortunately we cannot perform exhaustive checks on encrypted
@@ -153,103 +869,71 @@ static void check_password(const char *username, const char *shadow_pass,
                       errmsg("password must not contain user name")));
     }
   } else {
-    /*
-     * For unencrypted passwords we can perform better checks
-     */
-    const char *password = shadow_pass;
-    int pwdlen = strlen(password);
-
-    /* enforce minimum length */
-    if (pwdlen < passMinLength) {
-      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("password is too short.")));
-    }
-
-    /* check if the password contains the username */
-    if (strstr(password, username)) {
-      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("password must not contain user name.")));
-    }
-
-    check_policy(password);
-
-#ifdef USE_CRACKLIB
-    /* call cracklib to check password */
-    if (FascistCheck(password, CRACKLIB_DICTPATH)) {
-      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("password is easily cracked.")));
-    }
-#endif
+    check_plaintext_password(username, shadow_pass);
   }
 
   /* all checks passed, password is ok */
+  pp_age_record(username);
 }
-#else
-static void check_password(const char *username, const char *password,
-                           int password_type, Datum validuntil_time,
-                           bool validuntil_null) {
-  int namelen = strlen(username);
-  int pwdlen = strlen(password);
-  char encrypted[MD5_PASSWD_LEN + 1];
 
-  switch (password_type) {
-  case PASSWORD_TYPE_MD5:
-
-    /*
-     * Unfortunately we cannot perform exhaustive checks on encrypted
-     * passwords - we are restricted to guessing. (Alternatively, we
-     * could insist on the password being presented non-encrypted, but
-     * that has its own security disadvantages.)
-     *
-     * We only check for username = password.
-     */
-    if (!pg_md5_encrypt(username, username, namelen, encrypted)) {
-      elog(ERROR, "password encryption failed.");
-    }
-    if (strcmp(password, encrypted) == 0) {
-      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("password must not contain user name.")));
-    }
-    break;
+/*
+ * check_forbidden
+ *
+ * parses the comma separated p_policy.forbidden_substrings list
+ */
+static bool check_forbidden(char **newval, void **extra, GucSource source) {
+  ForbiddenList *list;
+  char *rawstring;
+  char *word;
+  char *saveptr = NULL;
 
-  case PASSWORD_TYPE_PLAINTEXT:
+  list = (ForbiddenList *)malloc(sizeof(ForbiddenList));
+  if (list == NULL) {
+    return false;
+  }
+  memset(list, 0, sizeof(ForbiddenList));
 
-    /*
-     * For unencrypted passwords we can perform better checks
-     */
+  rawstring = pstrdup(*newval ? *newval : "");
+  for (word = strtok_r(rawstring, ",", &saveptr); word != NULL;
+       word = strtok_r(NULL, ",", &saveptr)) {
+    char *end;
 
-    /* enforce minimum length */
-    if (pwdlen < passMinLength) {
-      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("password is too short.")));
+    while (*word == ' ') {
+      word++;
     }
-
-    /* check if the password contains the username */
-    if (strstr(password, username)) {
-      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("password must not contain user name.")));
+    end = word + strlen(word);
+    while (end > word && end[-1] == ' ') {
+      *--end = '\0';
     }
-
-    check_policy(password);
-
-#ifdef USE_CRACKLIB
-    /* call cracklib to check password */
-    if (FascistCheck(password, CRACKLIB_DICTPATH)) {
-      ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("password is easily cracked.")));
+    if (*word == '\0') {
+      continue;
     }
-#endif
-    break;
 
-  default:
-    elog(ERROR, "unrecognized password type: %d.", password_type);
-    break;
+    if (list->count >= PP_MAX_FORBIDDEN) {
+      GUC_check_errdetail("At most %d forbidden substrings are allowed.",
+                          PP_MAX_FORBIDDEN);
+      pfree(rawstring);
+      free(list);
+      return false;
+    }
+    if (strlen(word) > PP_MAX_PATTERN_LEN) {
+      GUC_check_errdetail("Forbidden substrings can be at most %d bytes long.",
+                          PP_MAX_PATTERN_LEN);
+      pfree(rawstring);
+      free(list);
+      return false;
+    }
+    strcpy(list->words[list->count++], word);
   }
+  pfree(rawstring);
 
-  /* all checks passed, password is ok */
+  *extra = list;
+  return true;
 }
 
-#endif
+static void assign_forbidden(const char *newval, void *extra) {
+  passForbiddenList = (ForbiddenList *)extra;
+}
 
 static void define_variables() {
   /* Define p_policy.min_pass_len */
@@ -277,15 +961,258 @@ static void define_variables() {
       "p_policy.min_lowercase_letter", "Minimum number of lower case letters.",
       NULL, &passMinLowerChar, 2, 1, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
 
+  /* Define p_policy.min_distinct_chars */
+  DefineCustomIntVariable(
+      "p_policy.min_distinct_chars", "Minimum number of different characters.",
+      NULL, &passMinDistinctChar, 6, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  /* Define p_policy.min_class_transitions */
+  DefineCustomIntVariable(
+      "p_policy.min_class_transitions",
+      "Minimum number of changes between character classes.", NULL,
+      &passMinTransitions, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.max_repeat_share */
+  DefineCustomRealVariable(
+      "p_policy.max_repeat_share",
+      "Largest share of the password a single character may take, 0 "
+      "disables the check.",
+      NULL, &passMaxRepeatShare, 0.5, 0.0, 1.0, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  /* Define p_policy.forbidden_substrings */
+  DefineCustomStringVariable(
+      "p_policy.forbidden_substrings",
+      "Comma separated substrings passwords must not contain.", NULL,
+      &passForbidden, "", PGC_SIGHUP, 0, check_forbidden, assign_forbidden,
+      NULL);
+
+  /* Define p_policy.shadow_enabled */
+  DefineCustomBoolVariable(
+      "p_policy.shadow_enabled",
+      "Evaluate accepted passwords against the shadow policy as well.", NULL,
+      &passShadowEnabled, false, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.shadow_min_password_len */
+  DefineCustomIntVariable("p_policy.shadow_min_password_len",
+                          "Minimum password length of the shadow policy.",
+                          NULL, &passShadowMinLength, 8, 0, INT_MAX,
+                          PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.shadow_min_special_chars */
+  DefineCustomIntVariable(
+      "p_policy.shadow_min_special_chars",
+      "Minimum number of special characters of the shadow policy.", NULL,
+      &passShadowMinSpcChar, 2, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.shadow_min_numbers */
+  DefineCustomIntVariable(
+      "p_policy.shadow_min_numbers",
+      "Minimum number of numeric characters of the shadow policy.", NULL,
+      &passShadowMinNumChar, 2, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.shadow_min_uppercase_letter */
+  DefineCustomIntVariable(
+      "p_policy.shadow_min_uppercase_letter",
+      "Minimum number of upper case letters of the shadow policy.", NULL,
+      &passShadowMinUpperChar, 2, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.shadow_min_lowercase_letter */
+  DefineCustomIntVariable(
+      "p_policy.shadow_min_lowercase_letter",
+      "Minimum number of lower case letters of the shadow policy.", NULL,
+      &passShadowMinLowerChar, 2, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.shadow_min_distinct_chars */
+  DefineCustomIntVariable(
+      "p_policy.shadow_min_distinct_chars",
+      "Minimum number of different characters of the shadow policy.", NULL,
+      &passShadowMinDistinctChar, 6, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  /* Define p_policy.shadow_min_class_transitions */
+  DefineCustomIntVariable(
+      "p_policy.shadow_min_class_transitions",
+      "Minimum number of changes between character classes of the shadow "
+      "policy.",
+      NULL, &passShadowMinTransitions, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL,
+      NULL, NULL);
+
+  /* Define p_policy.shadow_max_repeat_share */
+  DefineCustomRealVariable(
+      "p_policy.shadow_max_repeat_share",
+      "Largest share of the password a single character may take in the "
+      "shadow policy, 0 disables the check.",
+      NULL, &passShadowMaxRepeatShare, 0.5, 0.0, 1.0, PGC_SIGHUP, 0, NULL,
+      NULL, NULL);
+
+  /* Define p_policy.fast_path_min_entropy */
+  DefineCustomRealVariable(
+      "p_policy.fast_path_min_entropy",
+      "Entropy in bits above which random secrets skip the dictionary "
+      "checks, 0 disables it.",
+      NULL, &passFastPathMinEntropy, 128.0, 0.0, 100000.0, PGC_SIGHUP, 0, NULL,
+      NULL, NULL);
+
+  /* Define p_policy.metrics_port */
+  DefineCustomIntVariable(
+      "p_policy.metrics_port",
+      "TCP port to serve OpenMetrics on, 0 disables it.", NULL,
+      &passMetricsPort, 0, 0, 65535, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.metrics_listen_address */
+  DefineCustomStringVariable(
+      "p_policy.metrics_listen_address",
+      "IPv4 address the OpenMetrics port is bound to.", NULL,
+      &passMetricsListenAddress, "127.0.0.1", PGC_POSTMASTER, 0, NULL, NULL,
+      NULL);
+
+  /* Define p_policy.metrics_socket */
+  DefineCustomStringVariable(
+      "p_policy.metrics_socket",
+      "UNIX socket to serve OpenMetrics on, empty disables it.", NULL,
+      &passMetricsSocket, "", PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.database */
+  DefineCustomStringVariable(
+      "p_policy.database",
+      "Database the worker connects to and the denylist is managed in.", NULL,
+      &passDatabase, "postgres", PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.hot_tier_interval */
+  DefineCustomIntVariable(
+      "p_policy.hot_tier_interval",
+      "Seconds between promotions into the denylist hot tier, 0 disables "
+      "them.",
+      NULL, &passHotTierInterval, 10, 0, 86400, PGC_SIGHUP, GUC_UNIT_S, NULL,
+      NULL, NULL);
+
+  /* Define p_policy.hot_tier_size */
+  DefineCustomIntVariable(
+      "p_policy.hot_tier_size",
+      "Number of words the denylist hot tier holds, 0 disables it.", NULL,
+      &passHotTierSize, PP_HOT_TIER_SIZE, 0, PP_HOT_TIER_SIZE, PGC_SIGHUP, 0,
+      NULL, NULL, NULL);
+
+  /* Define p_policy.hot_tier_dump_interval */
+  DefineCustomIntVariable(
+      "p_policy.hot_tier_dump_interval",
+      "Seconds between dumps of the denylist hot tier to disk, 0 disables "
+      "them.",
+      NULL, &passHotTierDumpInterval, 300, 0, 86400, PGC_SIGHUP, GUC_UNIT_S,
+      NULL, NULL, NULL);
+
+  /* Define p_policy.denylist_max_words */
+  DefineCustomIntVariable(
+      "p_policy.denylist_max_words",
+      "Number of words the denylists can hold, 0 means no limit.", NULL,
+      &passDenylistMaxWords, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.backend_memory_limit */
+  DefineCustomIntVariable(
+      "p_policy.backend_memory_limit",
+      "Memory a backend keeps for password checks before dropping it, 0 "
+      "means no limit.",
+      NULL, &passBackendMemoryLimit, 0, 0, MAX_KILOBYTES, PGC_SIGHUP,
+      GUC_UNIT_KB, NULL, NULL, NULL);
+
+  /* Define p_policy.max_failed_logins */
+  DefineCustomIntVariable(
+      "p_policy.max_failed_logins",
+      "Failed logins after which a role is locked, 0 disables the lockout.",
+      NULL, &passMaxFailedLogins, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  /* Define p_policy.lockout_duration */
+  DefineCustomIntVariable(
+      "p_policy.lockout_duration",
+      "Seconds a role stays locked, and failed logins are remembered.", NULL,
+      &passLockoutDuration, 600, 1, 365 * 86400, PGC_SIGHUP, GUC_UNIT_S, NULL,
+      NULL, NULL);
+
+  /* Define p_policy.fuzzy_max_distance */
+  DefineCustomIntVariable(
+      "p_policy.fuzzy_max_distance",
+      "Edits within which passwords match denied words, 0 disables fuzzy "
+      "matching.",
+      NULL, &passFuzzyMaxDistance, 0, 0, 2, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.min_password_age */
+  DefineCustomIntVariable(
+      "p_policy.min_password_age",
+      "Seconds before a role can change its password again, 0 disables the "
+      "check.",
+      NULL, &passMinPasswordAge, 0, 0, INT_MAX / 1000, PGC_SIGHUP, GUC_UNIT_S,
+      NULL, NULL, NULL);
+
+  /* Define p_policy.max_tracked_roles */
+  DefineCustomIntVariable(
+      "p_policy.max_tracked_roles",
+      "Number of roles whose last password change is kept in shared memory.",
+      NULL, &passMaxTrackedRoles, 10000, 16, INT_MAX / 2, PGC_POSTMASTER, 0,
+      NULL, NULL, NULL);
+
+  /* Define p_policy.max_valid_days */
+  DefineCustomIntVariable(
+      "p_policy.max_valid_days",
+      "Days ahead the VALID UNTIL date of a password may be at most, 0 "
+      "allows any date.",
+      NULL, &passMaxValidDays, 0, 0, 36500, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  /* Define p_policy.expiry_warning_days */
+  DefineCustomIntVariable(
+      "p_policy.expiry_warning_days",
+      "Days ahead the worker looks for expiring roles, 0 disables the scan.",
+      NULL, &passExpiryWarningDays, 7, 0, 36500, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  /* Define p_policy.expiry_check_interval */
+  DefineCustomIntVariable(
+      "p_policy.expiry_check_interval",
+      "Seconds between two scans for expiring roles.", NULL,
+      &passExpiryCheckInterval, 3600, 1, 7 * 86400, PGC_SIGHUP, GUC_UNIT_S,
+      NULL, NULL, NULL);
+
+  /* Define p_policy.wal_log_changes */
+  DefineCustomBoolVariable(
+      "p_policy.wal_log_changes",
+      "Write changes of the denylists and password changes to WAL for "
+      "standbys.",
+      NULL, &passWalLogChanges, false, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
   if (passMinLength < (passMinSpcChar + passMinNumChar + passMinUpperChar + passMinLowerChar)) {
     ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                     errmsg("configuration error.\nsum of minimum character "
                            "requirement exceeds minimum password length.")));
   }
+  if (passMinLength < passMinDistinctChar) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("configuration error.\nminimum number of different "
+                           "characters exceeds minimum password length.")));
+  }
+  if (passMinLength <= passMinTransitions) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("configuration error.\nminimum number of class "
+                           "transitions exceeds minimum password length.")));
+  }
+  /* a password of minimum length has every character at least once */
+  if (passMaxRepeatShare > 0.0 && passMaxRepeatShare * passMinLength < 1.0) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("configuration error.\nmaximum repeat share is "
+                           "below one character of minimum password "
+                           "length.")));
+  }
 }
 
 /*
  * Module initialization function
+ *
+ * Runs in every backend when the module is preloaded, so it only defines
+ * the variables and installs hooks. Whatever a check needs, such as the
+ * mapping of the denylist index or the matchers, is built by the first
+ * check that uses it. Sessions that never set a password only go through
+ * the authentication hook of the lockout, see pp_lockout.c.
  */
 void _PG_init(void) {
   /* Be sure we do initialization only once */
@@ -300,5 +1227,26 @@ void _PG_init(void) {
   /* activate password checks when the module is loaded */
   check_password_hook = check_password;
 
+  /*
+   * statistics, the shadow policy and the lockout need shared memory and
+   * the worker
+   */
+  if (process_shared_preload_libraries_in_progress) {
+    pp_shmem_init();
+    pp_wal_init();
+    pp_register_worker();
+    pp_lockout_init();
+
+    if (passMetricsPort > 0 && passMetricsSocket[0] != '\0') {
+      ereport(ERROR,
+              (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+               errmsg("p_policy.metrics_port and p_policy.metrics_socket "
+                      "cannot both be set.")));
+    }
+    if (passMetricsPort > 0 || passMetricsSocket[0] != '\0') {
+      pp_register_metrics_worker();
+    }
+  }
+
   inited = true;
 }
@@ -0,0 +1,339 @@
+/*-------------------------------------------------------------------------
+ *
+ * passwordpolicy.h
+ *
+ * Declarations shared between the passwordpolicy source files.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PASSWORDPOLICY_H
+#define PASSWORDPOLICY_H
+
+#include "datatype/timestamp.h"
+#include "lib/dshash.h"
+#include "port/atomics.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/spin.h"
+#include "utils/dsa.h"
+#include "utils/memutils.h"
+#include "utils/snapshot.h"
+
+#include "pp_validate.h"
+
+/* number of features the shadow queue holds before dropping */
+#define PP_SHADOW_QUEUE_SIZE 1024
+
+/* number of denylists, each one is a bit in the entries of the index */
+#define PP_MAX_LISTS 32
+
+/*
+ * words the hot tier can hold, see p_policy.hot_tier_size, and words
+ * waiting to be considered for it
+ */
+#define PP_HOT_TIER_SIZE 64
+#define PP_HOT_CANDIDATES 256
+
+/* dimensions of the count-min sketch of denylist hits */
+#define PP_CMS_DEPTH 4
+#define PP_CMS_WIDTH 1024
+
+/* failed login counters, and slots probed looking for one */
+#define PP_LOCKOUT_SLOTS 4096
+#define PP_LOCKOUT_PROBES 32
+
+/* stages of check_password that are timed */
+typedef enum PPStage {
+  PP_STAGE_SASLPREP = 0,
+  PP_STAGE_POLICY,
+  PP_STAGE_DENYLIST,
+  PP_STAGE_FUZZY,
+  PP_STAGE_CRACKLIB,
+  PP_NUM_STAGES
+} PPStage;
+
+/* event counters, see passwordpolicy_counters */
+typedef enum PPCounter {
+  PP_COUNTER_SHADOW_DROPPED = 0,
+  PP_COUNTER_FAST_PATH,
+  PP_COUNTER_HOT_TIER,
+  PP_COUNTER_SASLPREP,
+  PP_COUNTER_LOCKED_LOGINS,
+  PP_NUM_COUNTERS
+} PPCounter;
+
+/* outcome of a stage of check_password */
+typedef struct PPStageResult {
+  bool ran;
+  PPRule verdict;
+  double time_us;
+  int64 bytes;
+  /* cache tier that answered the stage, NULL if it has none */
+  const char *cache_tier;
+  /* dictionary probes, 0 if the stage does not probe a dictionary */
+  int64 probes;
+  /* bitmask of the denylists that matched */
+  uint32 lists;
+} PPStageResult;
+
+/* latency histogram buckets, the last one is unbounded */
+#define PP_LATENCY_BUCKETS 12
+
+typedef struct PPLatency {
+  pg_atomic_uint64 buckets[PP_LATENCY_BUCKETS];
+  pg_atomic_uint64 count;
+  pg_atomic_uint64 sum_us;
+} PPLatency;
+
+/* what a match in a denylist does to the password */
+typedef enum PPListAction { PP_LIST_REJECT = 0, PP_LIST_WARN } PPListAction;
+
+/* a denylist, words in the index carry a bit per list containing them */
+typedef struct PPList {
+  bool used;
+  PPListAction action;
+  char name[NAMEDATALEN];
+  uint32 words;
+  pg_atomic_uint64 hits;
+} PPList;
+
+/* a frequently matched denylist word, zero padded */
+typedef struct PPHotEntry {
+  char word[PP_MAX_PATTERN_LEN + 1];
+  uint32 lists;
+  uint32 count;
+} PPHotEntry;
+
+/*
+ * Failed logins of a role, or of a role from an address. key is a hash of
+ * both, 0 while the slot is free; the timestamps are TimestampTz.
+ */
+typedef struct PPLockoutSlot {
+  pg_atomic_uint64 key;
+  pg_atomic_uint32 failures;
+  pg_atomic_uint64 last_failure;
+  pg_atomic_uint64 locked_until;
+} PPLockoutSlot;
+
+/*
+ * State in the main shared memory segment. Only present when the module
+ * is loaded through shared_preload_libraries.
+ */
+typedef struct PPSharedState {
+  /* verdicts of the enforced and the shadow policy, indexed by PPRule */
+  pg_atomic_uint64 verdicts[PP_NUM_RULES];
+  pg_atomic_uint64 shadow_verdicts[PP_NUM_RULES];
+  pg_atomic_uint64 counters[PP_NUM_COUNTERS];
+
+  /* time spent in each stage of check_password */
+  PPLatency stages[PP_NUM_STAGES];
+
+  /* features waiting for the worker to evaluate the shadow policy */
+  slock_t queue_lock;
+  uint64 queue_head;
+  uint64 queue_tail;
+  Latch *worker_latch;
+  PPFeatures queue[PP_SHADOW_QUEUE_SIZE];
+
+  /*
+   * The denylists, merged into one dshash table in dynamic shared memory
+   * created on first use. lock protects the handles, the length bounds and
+   * the list definitions but not the hit counters; reject_lists has the
+   * bits of the lists with action reject. The generation changes whenever
+   * a word or list is added or removed.
+   */
+  LWLock *lock;
+  int dsa_tranche_id;
+  dsa_handle denylist_area;
+  dshash_table_handle denylist_hash;
+  bool denylist_loaded;
+  int denylist_min_len;
+  int denylist_max_len;
+  uint32 denylist_lengths[PP_MAX_PATTERN_LEN + 1];
+  pg_atomic_uint32 denylist_entries;
+  pg_atomic_uint64 denylist_generation;
+  pg_atomic_uint32 reject_lists;
+  PPList lists[PP_MAX_LISTS];
+
+  /*
+   * The trie of the denylist words for fuzzy matching, in the area of the
+   * index. The worker builds it and is its only writer; trie_lock protects
+   * the pointer and is held shared while a backend walks the trie.
+   */
+  LWLock *trie_lock;
+  dsa_pointer trie;
+  int32 trie_nodes;
+  uint64 trie_generation;
+
+  /*
+   * Records replayed from WAL, waiting in the area of the index for the
+   * worker to see whether their transaction commits, see pp_wal.c; lock
+   * protects the list.
+   */
+  dsa_pointer staged_head;
+  dsa_pointer staged_tail;
+
+  /*
+   * Hits of denylist words are counted in a count-min sketch. The worker
+   * periodically promotes the words with the highest counts into the hot
+   * tier, which check_password scans before probing the index. The worker
+   * is its only writer: hot_seq is odd while it rewrites the tier, and the
+   * tier is only valid while hot_generation matches denylist_generation.
+   * Backends suggest words counted at least hot_threshold times as
+   * candidates.
+   */
+  pg_atomic_uint32 cms[PP_CMS_DEPTH][PP_CMS_WIDTH];
+  pg_atomic_uint32 hot_threshold;
+  pg_atomic_uint64 hot_seq;
+  uint64 hot_generation;
+  int hot_count;
+  PPHotEntry hot[PP_HOT_TIER_SIZE];
+  slock_t candidate_lock;
+  int ncandidates;
+  char candidates[PP_HOT_CANDIDATES][PP_MAX_PATTERN_LEN + 1];
+
+  /*
+   * Failed login counters, an open addressing hash table updated with
+   * atomics only. Slots are never emptied, slots whose lockout and last
+   * failure are older than p_policy.lockout_duration are reused instead.
+   */
+  PPLockoutSlot lockout[PP_LOCKOUT_SLOTS];
+
+  /*
+   * age_lock protects the hash table of password changes, see pp_age.c;
+   * age_dirty is set while some of them are not in the table yet.
+   */
+  LWLock *age_lock;
+  bool age_dirty;
+  bool age_full;
+} PPSharedState;
+
+extern PPSharedState *pp_shared;
+extern const uint64 pp_latency_bounds_us[PP_LATENCY_BUCKETS - 1];
+
+/* GUC variables, see passwordpolicy.c */
+extern int passMinLength;
+extern int passMinSpcChar;
+extern int passMinNumChar;
+extern int passMinUpperChar;
+extern int passMinLowerChar;
+extern int passMinDistinctChar;
+extern int passMinTransitions;
+extern double passMaxRepeatShare;
+extern bool passShadowEnabled;
+extern int passShadowMinLength;
+extern int passShadowMinSpcChar;
+extern int passShadowMinNumChar;
+extern int passShadowMinUpperChar;
+extern int passShadowMinLowerChar;
+extern int passShadowMinDistinctChar;
+extern int passShadowMinTransitions;
+extern double passShadowMaxRepeatShare;
+extern double passFastPathMinEntropy;
+extern int passMetricsPort;
+extern char *passMetricsListenAddress;
+extern char *passMetricsSocket;
+extern char *passDatabase;
+extern int passHotTierInterval;
+extern int passHotTierSize;
+extern int passDenylistMaxWords;
+extern int passBackendMemoryLimit;
+extern int passMaxFailedLogins;
+extern int passLockoutDuration;
+extern int passFuzzyMaxDistance;
+extern int passHotTierDumpInterval;
+extern int passMinPasswordAge;
+extern int passMaxTrackedRoles;
+extern int passMaxValidDays;
+extern int passExpiryWarningDays;
+extern int passExpiryCheckInterval;
+extern bool passWalLogChanges;
+
+/* pp_shmem.c */
+extern void pp_shmem_init(void);
+extern Size pp_shmem_size(void);
+extern void pp_count_verdict(PPRule rule);
+extern void pp_count(PPCounter counter);
+extern const char *pp_counter_name(PPCounter counter);
+extern const char *pp_counter_help(PPCounter counter);
+extern void pp_observe_stage(PPStage stage, uint64 us);
+extern const char *pp_stage_name(PPStage stage);
+extern void pp_require_shared(void);
+
+/* pp_worker.c */
+extern void pp_register_worker(void);
+extern void pp_shadow_enqueue(const PPFeatures *features);
+extern void pp_wake_worker(void);
+extern PGDLLEXPORT void passwordpolicy_worker_main(Datum main_arg);
+
+/* pp_denylist.c */
+extern bool pp_denylist_ready(void);
+extern void pp_denylist_check(const char *password, bool observe,
+                              PPStageResult *result);
+extern bool pp_denylist_lookup(const char *word, uint32 *lists);
+extern PPRule pp_denylist_verdict(uint32 lists);
+extern void pp_denylist_report(uint32 lists, bool accepted);
+extern char *pp_denylist_names(uint32 lists);
+extern bool pp_denylist_load(void);
+extern void pp_denylist_redo(const char *data, Size len);
+extern char *pp_extension_schema(void);
+extern void pp_denylist_detach(void);
+extern dsa_area *pp_denylist_area(bool create);
+extern Size pp_denylist_size(void);
+
+typedef void (*pp_denylist_callback)(const char *word, uint32 lists,
+                                     void *arg);
+extern void pp_denylist_foreach(pp_denylist_callback callback, void *arg);
+
+/* pp_hot.c */
+extern void pp_hot_observe(const char *word);
+extern uint32 pp_hot_check(const char *folded, bool observe);
+extern void pp_hot_promote(void);
+extern void pp_hot_dump(void);
+extern void pp_hot_restore(void);
+
+/* pp_fuzzy.c */
+extern void pp_fuzzy_check(const char *password, PPStageResult *result);
+extern void pp_fuzzy_build(void);
+extern bool pp_fuzzy_size(int64 *size, int64 *nodes, uint64 *generation);
+
+/* pp_saslprep.c */
+extern const char *pp_saslprep(const char *str);
+
+/* pp_lockout.c */
+extern void pp_lockout_init(void);
+
+/* pp_age.c */
+extern Size pp_age_shmem_size(void);
+extern void pp_age_shmem_startup(void);
+extern void pp_age_check(const char *username);
+extern void pp_age_record(const char *username);
+extern void pp_age_load(void);
+extern void pp_age_flush(void);
+extern void pp_age_redo(const char *data, Size len);
+
+/* pp_expiry.c */
+extern TimestampTz pp_expiry_limit(void);
+extern void pp_expiry_check(Datum validuntil_time, bool validuntil_null);
+extern void pp_expiry_scan(void);
+
+/* pp_wal.c, record types */
+#define XLOG_PP_DENYLIST 0x00
+#define XLOG_PP_PASSWORD_CHANGES 0x10
+
+extern void pp_wal_init(void);
+extern void pp_wal_log(uint8 info, char *data, Size len);
+extern void pp_wal_skip_visible(dsa_area *area, Snapshot snapshot);
+extern void pp_wal_apply(void);
+
+/* pp_memory.c */
+extern MemoryContext pp_backend_context(void);
+extern void pp_memory_enforce(void);
+
+/* pp_metrics.c */
+extern void pp_register_metrics_worker(void);
+extern PGDLLEXPORT void passwordpolicy_metrics_main(Datum main_arg);
+
+#endif /* PASSWORDPOLICY_H */
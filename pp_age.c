@@ -0,0 +1,450 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_age.c
+ *
+ * Minimum password age.
+ *
+ * With p_policy.min_password_age set, a role changing its own password
+ * again too soon is rejected. Changes of other roles' passwords, such as
+ * an administrator resetting one, are always allowed. The role changing
+ * the password is the session user, the one that logged in: a SECURITY
+ * DEFINER function or SET ROLE doesn't get a role around the check.
+ *
+ * The time of the last change of every role is kept in a hash table in
+ * shared memory, so check_password answers with one probe. The change is
+ * recorded when the transaction setting the password commits. The worker,
+ * connected to p_policy.database, writes recorded changes through to the
+ * passwordpolicy_password_changes table as soon as they commit, since
+ * roles are shared between databases while the table is not, and loads
+ * the table back after a restart.
+ *
+ * With p_policy.wal_log_changes set, the changes of a transaction are also
+ * written to WAL before it commits, so standbys record them in their own
+ * table once the transaction commits, see pp_wal.c. They stay dirty there,
+ * and the worker writes them through once the standby is promoted. A
+ * change only ever moves the time of a role forward, so the order in which
+ * they are recorded does not matter.
+ *
+ * The table holds p_policy.max_tracked_roles roles; when it is full,
+ * further roles are not tracked.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "nodes/pg_list.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+#include "passwordpolicy.h"
+
+/* last password change of a role */
+typedef struct PPAgeEntry {
+  NameData role;
+  TimestampTz changed_at;
+  /* not written to the table yet */
+  bool dirty;
+} PPAgeEntry;
+
+/* a change to record when the transaction commits */
+typedef struct PPAgeChange {
+  SubTransactionId subid;
+  NameData role;
+} PPAgeChange;
+
+/* WAL record of the changes of a transaction */
+typedef struct PPAgeRecord {
+  TimestampTz changed_at;
+  int32 nroles;
+  NameData roles[FLEXIBLE_ARRAY_MEMBER];
+} PPAgeRecord;
+
+static HTAB *age_hash = NULL;
+
+/* changes of the current transaction, allocated in TopTransactionContext */
+static List *pending_changes = NIL;
+static TimestampTz pending_at = 0;
+static bool callbacks_registered = false;
+
+/* bytes of shared memory the hash table needs */
+Size pp_age_shmem_size(void) {
+  return hash_estimate_size(passMaxTrackedRoles, sizeof(PPAgeEntry));
+}
+
+/*
+ * pp_age_shmem_startup
+ *
+ * creates or attaches to the hash table, called from the shared memory
+ * startup hook with AddinShmemInitLock held
+ */
+void pp_age_shmem_startup(void) {
+  HASHCTL info;
+
+  memset(&info, 0, sizeof(info));
+  info.keysize = NAMEDATALEN;
+  info.entrysize = sizeof(PPAgeEntry);
+  age_hash = ShmemInitHash("passwordpolicy password changes",
+                           passMaxTrackedRoles, passMaxTrackedRoles, &info,
+                           HASH_ELEM | HASH_STRINGS);
+}
+
+/* records a change, pp_shared->age_lock must be held exclusively */
+static void record_change(const char *role, TimestampTz changed_at,
+                          bool dirty) {
+  PPAgeEntry *entry;
+  bool found;
+
+  entry = hash_search(age_hash, role, HASH_ENTER_NULL, &found);
+  if (entry == NULL) {
+    if (!pp_shared->age_full) {
+      pp_shared->age_full = true;
+      ereport(LOG,
+              (errmsg("passwordpolicy tracks at most %d roles, further "
+                      "password changes are not tracked.",
+                      passMaxTrackedRoles),
+               errhint("Raise p_policy.max_tracked_roles.")));
+    }
+    return;
+  }
+  if (found && entry->changed_at >= changed_at) {
+    return;
+  }
+  entry->changed_at = changed_at;
+  entry->dirty = dirty;
+  if (dirty) {
+    pp_shared->age_dirty = true;
+  }
+}
+
+/* logs the changes of the committing transaction */
+static void log_pending_changes(void) {
+  PPAgeRecord *rec;
+  int nroles = 0;
+  ListCell *lc;
+
+  pending_at = GetCurrentTimestamp();
+  if (pending_changes == NIL) {
+    return;
+  }
+
+  rec = (PPAgeRecord *)palloc(offsetof(PPAgeRecord, roles) +
+                              sizeof(NameData) * list_length(pending_changes));
+  rec->changed_at = pending_at;
+  foreach (lc, pending_changes) {
+    rec->roles[nroles++] = ((PPAgeChange *)lfirst(lc))->role;
+  }
+  rec->nroles = nroles;
+
+  pp_wal_log(XLOG_PP_PASSWORD_CHANGES, (char *)rec,
+             offsetof(PPAgeRecord, roles) + sizeof(NameData) * nroles);
+  pfree(rec);
+}
+
+/* records the changes of the transaction that just committed */
+static void apply_pending_changes(void) {
+  ListCell *lc;
+
+  if (pending_changes == NIL) {
+    return;
+  }
+
+  LWLockAcquire(pp_shared->age_lock, LW_EXCLUSIVE);
+  foreach (lc, pending_changes) {
+    record_change(NameStr(((PPAgeChange *)lfirst(lc))->role), pending_at,
+                  true);
+  }
+  LWLockRelease(pp_shared->age_lock);
+  pending_changes = NIL;
+
+  /* have the worker write the changes through */
+  pp_wake_worker();
+}
+
+static void age_xact_callback(XactEvent event, void *arg) {
+  switch (event) {
+  case XACT_EVENT_PRE_COMMIT:
+  case XACT_EVENT_PARALLEL_PRE_COMMIT:
+    log_pending_changes();
+    break;
+  case XACT_EVENT_COMMIT:
+  case XACT_EVENT_PARALLEL_COMMIT:
+    apply_pending_changes();
+    break;
+  case XACT_EVENT_ABORT:
+  case XACT_EVENT_PARALLEL_ABORT:
+  case XACT_EVENT_PREPARE:
+    /* the list went away with TopTransactionContext */
+    pending_changes = NIL;
+    break;
+  default:
+    break;
+  }
+}
+
+static void age_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                                 SubTransactionId parentSubid, void *arg) {
+  ListCell *lc;
+
+  if (event == SUBXACT_EVENT_COMMIT_SUB) {
+    foreach (lc, pending_changes) {
+      PPAgeChange *change = (PPAgeChange *)lfirst(lc);
+
+      if (change->subid == mySubid) {
+        change->subid = parentSubid;
+      }
+    }
+  } else if (event == SUBXACT_EVENT_ABORT_SUB) {
+    foreach (lc, pending_changes) {
+      PPAgeChange *change = (PPAgeChange *)lfirst(lc);
+
+      if (change->subid == mySubid) {
+        pending_changes = foreach_delete_current(pending_changes, lc);
+      }
+    }
+  }
+}
+
+/*
+ * pp_age_check
+ *
+ * rejects the session user changing its own password before it is
+ * p_policy.min_password_age old
+ */
+void pp_age_check(const char *username) {
+  PPAgeEntry *entry;
+  TimestampTz changed_at = 0;
+  bool found = false;
+
+  if (pp_shared == NULL || passMinPasswordAge <= 0) {
+    return;
+  }
+  if (strcmp(username, GetUserNameFromId(GetSessionUserId(), false)) != 0) {
+    return;
+  }
+
+  LWLockAcquire(pp_shared->age_lock, LW_SHARED);
+  entry = hash_search(age_hash, username, HASH_FIND, NULL);
+  if (entry != NULL) {
+    changed_at = entry->changed_at;
+    found = true;
+  }
+  LWLockRelease(pp_shared->age_lock);
+
+  if (found &&
+      !TimestampDifferenceExceeds(changed_at, GetCurrentTimestamp(),
+                                  passMinPasswordAge * 1000)) {
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("password must be atleast %d seconds old before it is "
+                    "changed.",
+                    passMinPasswordAge)));
+  }
+}
+
+/*
+ * pp_age_record
+ *
+ * records that the password of a role changes when the transaction
+ * commits
+ */
+void pp_age_record(const char *username) {
+  MemoryContext oldcontext;
+  PPAgeChange *change;
+
+  if (pp_shared == NULL || strlen(username) >= NAMEDATALEN) {
+    return;
+  }
+
+  if (!callbacks_registered) {
+    RegisterXactCallback(age_xact_callback, NULL);
+    RegisterSubXactCallback(age_subxact_callback, NULL);
+    callbacks_registered = true;
+  }
+
+  oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+  change = (PPAgeChange *)palloc0(sizeof(PPAgeChange));
+  change->subid = GetCurrentSubTransactionId();
+  namestrcpy(&change->role, username);
+  pending_changes = lappend(pending_changes, change);
+  MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * pp_age_redo
+ *
+ * records the changes of a transaction logged by another server, or by
+ * this one before a crash, once it committed; called by the worker, see
+ * pp_wal_apply
+ */
+void pp_age_redo(const char *data, Size len) {
+  const PPAgeRecord *rec = (const PPAgeRecord *)data;
+  int i;
+
+  if (len < offsetof(PPAgeRecord, roles) ||
+      len != offsetof(PPAgeRecord, roles) + sizeof(NameData) * rec->nroles) {
+    elog(LOG, "passwordpolicy skips a corrupt password change record.");
+    return;
+  }
+
+  LWLockAcquire(pp_shared->age_lock, LW_EXCLUSIVE);
+  for (i = 0; i < rec->nroles; i++) {
+    record_change(NameStr(rec->roles[i]), rec->changed_at, true);
+  }
+  LWLockRelease(pp_shared->age_lock);
+}
+
+/* returns the quoted schema of the table, NULL if there is none */
+static char *table_schema(void) {
+  char *schema = pp_extension_schema();
+
+  if (schema == NULL ||
+      !OidIsValid(get_relname_relid("passwordpolicy_password_changes",
+                                    get_namespace_oid(schema, false)))) {
+    return NULL;
+  }
+  return (char *)quote_identifier(schema);
+}
+
+/*
+ * pp_age_load
+ *
+ * copies the passwordpolicy_password_changes table into shared memory,
+ * called by the worker once it is connected to p_policy.database
+ */
+void pp_age_load(void) {
+  char *schema;
+  uint64 i;
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  SPI_connect();
+  PushActiveSnapshot(GetTransactionSnapshot());
+
+  schema = table_schema();
+  if (schema != NULL) {
+    int ret = SPI_execute(
+        psprintf("SELECT role, changed_at FROM "
+                 "%s.passwordpolicy_password_changes",
+                 schema),
+        true, 0);
+
+    if (ret != SPI_OK_SELECT) {
+      elog(ERROR, "SPI_execute failed: error code %d.", ret);
+    }
+
+    LWLockAcquire(pp_shared->age_lock, LW_EXCLUSIVE);
+    for (i = 0; i < SPI_processed; i++) {
+      HeapTuple tuple = SPI_tuptable->vals[i];
+      TupleDesc tupdesc = SPI_tuptable->tupdesc;
+      bool isnull;
+      Datum role = SPI_getbinval(tuple, tupdesc, 1, &isnull);
+      Datum changed_at = SPI_getbinval(tuple, tupdesc, 2, &isnull);
+
+      record_change(NameStr(*DatumGetName(role)),
+                    DatumGetTimestampTz(changed_at), false);
+    }
+    LWLockRelease(pp_shared->age_lock);
+
+    elog(LOG, "passwordpolicy loaded " UINT64_FORMAT " password changes.",
+         SPI_processed);
+  }
+
+  SPI_finish();
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+}
+
+/*
+ * pp_age_flush
+ *
+ * writes the changes recorded since the last call to the
+ * passwordpolicy_password_changes table, called by the worker
+ */
+void pp_age_flush(void) {
+  PPAgeEntry *dirty;
+  HASH_SEQ_STATUS status;
+  PPAgeEntry *entry;
+  char *schema;
+  int ndirty = 0;
+  int i;
+
+  /* replayed changes wait for the promotion */
+  if (RecoveryInProgress()) {
+    return;
+  }
+
+  LWLockAcquire(pp_shared->age_lock, LW_SHARED);
+  if (!pp_shared->age_dirty) {
+    LWLockRelease(pp_shared->age_lock);
+    return;
+  }
+  dirty = (PPAgeEntry *)palloc(sizeof(PPAgeEntry) *
+                               hash_get_num_entries(age_hash));
+  hash_seq_init(&status, age_hash);
+  while ((entry = hash_seq_search(&status)) != NULL) {
+    if (entry->dirty) {
+      dirty[ndirty++] = *entry;
+    }
+  }
+  LWLockRelease(pp_shared->age_lock);
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  SPI_connect();
+  PushActiveSnapshot(GetTransactionSnapshot());
+
+  schema = table_schema();
+  if (schema != NULL) {
+    char *sql = psprintf(
+        "INSERT INTO %s.passwordpolicy_password_changes AS c "
+        "(role, changed_at) VALUES ($1, $2) ON CONFLICT (role) DO UPDATE "
+        "SET changed_at = greatest(c.changed_at, excluded.changed_at)",
+        schema);
+    Oid argtypes[2] = {NAMEOID, TIMESTAMPTZOID};
+
+    for (i = 0; i < ndirty; i++) {
+      Datum values[2];
+      int ret;
+
+      values[0] = NameGetDatum(&dirty[i].role);
+      values[1] = TimestampTzGetDatum(dirty[i].changed_at);
+      ret = SPI_execute_with_args(sql, 2, argtypes, values, NULL, false, 0);
+      if (ret != SPI_OK_INSERT) {
+        elog(ERROR, "SPI_execute_with_args failed: error code %d.", ret);
+      }
+    }
+  }
+
+  SPI_finish();
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+
+  /* entries changed again meanwhile stay dirty */
+  LWLockAcquire(pp_shared->age_lock, LW_EXCLUSIVE);
+  for (i = 0; i < ndirty; i++) {
+    entry = hash_search(age_hash, NameStr(dirty[i].role), HASH_FIND, NULL);
+    if (entry != NULL && entry->changed_at == dirty[i].changed_at) {
+      entry->dirty = false;
+    }
+  }
+  pp_shared->age_dirty = false;
+  hash_seq_init(&status, age_hash);
+  while ((entry = hash_seq_search(&status)) != NULL) {
+    pp_shared->age_dirty |= entry->dirty;
+  }
+  LWLockRelease(pp_shared->age_lock);
+
+  pfree(dirty);
+}
@@ -0,0 +1,48 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_confusables.h
+ *
+ * Non-ASCII characters that look like an ASCII character.
+ *
+ * A subset of the Unicode confusables (UTS #39) with single ASCII
+ * character prototypes: the Cyrillic, Greek, Armenian and Latin letters
+ * used to spoof Latin ones. Full-width forms are mapped arithmetically in
+ * pp_validate.c. Sorted by code point for binary search.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PP_CONFUSABLES_H
+#define PP_CONFUSABLES_H
+
+#include <stdint.h>
+
+typedef struct PPConfusable {
+  uint16_t codepoint;
+  char prototype;
+} PPConfusable;
+
+static const PPConfusable pp_confusables[] = {
+    {0x0131, 'i'}, {0x0237, 'j'}, {0x0251, 'a'}, {0x0261, 'g'},
+    {0x0391, 'A'}, {0x0392, 'B'}, {0x0395, 'E'}, {0x0396, 'Z'},
+    {0x0397, 'H'}, {0x0399, 'I'}, {0x039A, 'K'}, {0x039C, 'M'},
+    {0x039D, 'N'}, {0x039F, 'O'}, {0x03A1, 'P'}, {0x03A4, 'T'},
+    {0x03A5, 'Y'}, {0x03A7, 'X'}, {0x03B1, 'a'}, {0x03B3, 'y'},
+    {0x03B9, 'i'}, {0x03BA, 'k'}, {0x03BD, 'v'}, {0x03BF, 'o'},
+    {0x03C1, 'p'}, {0x03C5, 'u'}, {0x03F2, 'c'}, {0x03F3, 'j'},
+    {0x0405, 'S'}, {0x0406, 'I'}, {0x0408, 'J'}, {0x0410, 'A'},
+    {0x0412, 'B'}, {0x0415, 'E'}, {0x041A, 'K'}, {0x041C, 'M'},
+    {0x041D, 'H'}, {0x041E, 'O'}, {0x0420, 'P'}, {0x0421, 'C'},
+    {0x0422, 'T'}, {0x0423, 'Y'}, {0x0425, 'X'}, {0x0430, 'a'},
+    {0x0435, 'e'}, {0x043E, 'o'}, {0x0440, 'p'}, {0x0441, 'c'},
+    {0x0443, 'y'}, {0x0445, 'x'}, {0x0455, 's'}, {0x0456, 'i'},
+    {0x0458, 'j'}, {0x04AE, 'Y'}, {0x04BB, 'h'}, {0x04C0, 'l'},
+    {0x04CF, 'l'}, {0x0501, 'd'}, {0x051A, 'Q'}, {0x051B, 'q'},
+    {0x051C, 'W'}, {0x051D, 'w'}, {0x0570, 'h'}, {0x0578, 'n'},
+    {0x057D, 'u'}, {0x0585, 'o'}, {0x2113, 'l'}, {0x212A, 'K'},
+};
+
+#define PP_NUM_CONFUSABLES (sizeof(pp_confusables) / sizeof(pp_confusables[0]))
+
+#endif /* PP_CONFUSABLES_H */
@@ -0,0 +1,335 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_corpus.c
+ *
+ * Deterministic generator of synthetic password corpora.
+ *
+ * Passwords are drawn from a mix of the shapes seen in practice: a word
+ * with digits appended, keyboard walks, passphrases, machine generated
+ * secrets and words with non-ASCII letters mixed in. The generator is
+ * xoshiro256** seeded through splitmix64 and never allocates.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <string.h>
+
+#include "pp_corpus.h"
+
+static const char *const kind_names[PP_CORPUS_NUM_KINDS] = {
+    "word_digits", "keyboard_walk", "passphrase", "random_secret",
+    "utf8_mix",
+};
+
+/* share of each kind in the corpus, in percent */
+static const int kind_weights[PP_CORPUS_NUM_KINDS] = {35, 10, 15, 30, 10};
+
+/* a string and its length, so the hot loop never calls strlen */
+typedef struct PPCorpusStr {
+  const char *str;
+  size_t len;
+} PPCorpusStr;
+
+#define W(s) {s, sizeof(s) - 1}
+
+static const PPCorpusStr words[] = {
+    W("password"), W("dragon"), W("monkey"), W("shadow"), W("master"),
+    W("sunshine"), W("princess"), W("football"), W("baseball"), W("welcome"),
+    W("letmein"), W("freedom"), W("whatever"), W("trustno1"), W("summer"),
+    W("winter"), W("autumn"), W("spring"), W("secret"), W("orange"),
+    W("banana"), W("cherry"), W("coffee"), W("chocolate"), W("tiger"),
+    W("falcon"), W("eagle"), W("silver"), W("golden"), W("purple"),
+    W("thunder"), W("rainbow"), W("forest"), W("river"), W("ocean"),
+    W("mountain"), W("castle"), W("garden"), W("pirate"), W("ninja"),
+    W("wizard"), W("knight"), W("hunter"), W("soccer"), W("hockey"),
+    W("tennis"), W("guitar"), W("piano"), W("london"), W("berlin"), W("paris"),
+    W("tokyo"), W("madrid"), W("dublin"), W("charlie"), W("jessica"),
+    W("michael"), W("daniel"), W("andrew"), W("maggie"), W("pepper"),
+    W("buster"), W("ginger"), W("snoopy"),
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+static const PPCorpusStr keyboard_rows[] = {
+    W("1234567890"),
+    W("qwertyuiop"),
+    W("asdfghjkl"),
+    W("zxcvbnm"),
+};
+
+static const char secret_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
+    "!#$%&()*+,-./:;<=>?@[]^_{|}~";
+
+static const char passphrase_separators[] = "-. _";
+
+static const char symbols[] = "!@#$%&*?";
+
+/* two byte UTF-8 letters, accented Latin and Cyrillic */
+static const PPCorpusStr utf8_letters[] = {
+    W("\xc3\xa9"), W("\xc3\xbc"), W("\xc3\xb1"), W("\xc3\xb8"), W("\xc3\xa5"),
+    W("\xc3\xa7"), W("\xc3\x9f"), W("\xd0\xb0"), W("\xd0\xb5"), W("\xd0\xbe"),
+    W("\xd1\x80"), W("\xd1\x81"), W("\xd0\x96"), W("\xd0\xaf"),
+};
+
+#define NUM_UTF8_LETTERS (sizeof(utf8_letters) / sizeof(utf8_letters[0]))
+
+static inline uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t next_u64(PPCorpus *corpus) {
+  uint64_t *s = corpus->state;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+/* uniform integer in [0, n) */
+static inline uint32_t uniform(PPCorpus *corpus, uint32_t n) {
+  return (uint32_t)(((next_u64(corpus) >> 32) * n) >> 32);
+}
+
+/* uniform integer in [lo, hi] */
+static inline int between(PPCorpus *corpus, int lo, int hi) {
+  return lo + (int)uniform(corpus, (uint32_t)(hi - lo + 1));
+}
+
+static inline size_t append_str(char *buf, size_t len,
+                                const PPCorpusStr *str) {
+  size_t n = str->len;
+
+  if (len + n >= PP_CORPUS_MAX_LEN) {
+    n = PP_CORPUS_MAX_LEN - 1 - len;
+  }
+  memcpy(buf + len, str->str, n);
+  return len + n;
+}
+
+static inline size_t append_char(char *buf, size_t len, char c) {
+  if (len < PP_CORPUS_MAX_LEN - 1) {
+    buf[len++] = c;
+  }
+  return len;
+}
+
+static inline char upper(char c) {
+  return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+/* dragon1, Summer2019!, monkey12 */
+static size_t gen_word_digits(PPCorpus *corpus, char *buf) {
+  size_t len = append_str(buf, 0, &words[uniform(corpus, NUM_WORDS)]);
+  int ndigits;
+  int i;
+
+  if (uniform(corpus, 100) < 40) {
+    buf[0] = upper(buf[0]);
+  }
+
+  if (uniform(corpus, 100) < 30) {
+    /* a year */
+    int year = between(corpus, 1950, 2025);
+
+    for (i = 1000; i > 0; i /= 10) {
+      len = append_char(buf, len, (char)('0' + (year / i) % 10));
+    }
+  } else {
+    ndigits = between(corpus, 1, 4);
+    for (i = 0; i < ndigits; i++) {
+      len = append_char(buf, len, (char)('0' + uniform(corpus, 10)));
+    }
+  }
+
+  if (uniform(corpus, 100) < 25) {
+    len = append_char(buf, len, symbols[uniform(corpus, sizeof(symbols) - 1)]);
+  }
+  return len;
+}
+
+/* qwerty, asdfgh, 1qaz2wsx-like walks that wander between rows */
+static size_t gen_keyboard_walk(PPCorpus *corpus, char *buf) {
+  int row = (int)uniform(corpus, 4);
+  int pos = (int)uniform(corpus, (uint32_t)keyboard_rows[row].len);
+  int dir = uniform(corpus, 100) < 80 ? 1 : -1;
+  int steps = between(corpus, 6, 14);
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < steps; i++) {
+    int rowlen = (int)keyboard_rows[row].len;
+
+    if (pos < 0) {
+      pos = 0;
+    } else if (pos >= rowlen) {
+      pos = rowlen - 1;
+    }
+    len = append_char(buf, len, keyboard_rows[row].str[pos]);
+
+    if (uniform(corpus, 100) < 20) {
+      /* hop to a neighbouring row */
+      row = row == 0 ? 1 : (row == 3 ? 2 : row + (uniform(corpus, 2) ? 1 : -1));
+    } else {
+      pos += dir;
+      if (pos < 0 || pos >= rowlen) {
+        dir = -dir;
+        pos += 2 * dir;
+      }
+    }
+  }
+  return len;
+}
+
+/* correct-horse-battery-staple */
+static size_t gen_passphrase(PPCorpus *corpus, char *buf) {
+  int nwords = between(corpus, 3, 5);
+  uint32_t sep = uniform(corpus, sizeof(passphrase_separators));
+  bool capitalize = uniform(corpus, 100) < 30;
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < nwords; i++) {
+    size_t start = len;
+
+    /* sep == sizeof - 1 picks the terminator: words run together */
+    if (i > 0 && passphrase_separators[sep] != '\0') {
+      len = append_char(buf, len, passphrase_separators[sep]);
+      start = len;
+    }
+    len = append_str(buf, len, &words[uniform(corpus, NUM_WORDS)]);
+    if (capitalize && start < len) {
+      buf[start] = upper(buf[start]);
+    }
+  }
+  if (uniform(corpus, 100) < 30) {
+    len = append_char(buf, len, (char)('0' + uniform(corpus, 10)));
+  }
+  return len;
+}
+
+/* what a secret manager sets: 16 to 64 uniformly random characters */
+static size_t gen_random_secret(PPCorpus *corpus, char *buf) {
+  int length = uniform(corpus, 100) < 80 ? between(corpus, 40, 64)
+                                         : between(corpus, 16, 39);
+  uint32_t alphabet = uniform(corpus, 100) < 30 ? 62 : sizeof(secret_alphabet) - 1;
+  uint64_t bits = 0;
+  int i;
+
+  /* four characters from every 64 random bits */
+  for (i = 0; i < length; i++) {
+    if ((i & 3) == 0) {
+      bits = next_u64(corpus);
+    }
+    buf[i] = secret_alphabet[((bits & 0xffff) * alphabet) >> 16];
+    bits >>= 16;
+  }
+  return (size_t)length;
+}
+
+/* words with accented or Cyrillic letters mixed in */
+static size_t gen_utf8_mix(PPCorpus *corpus, char *buf) {
+  const PPCorpusStr *word = &words[uniform(corpus, NUM_WORDS)];
+  size_t len = 0;
+  int ndigits = between(corpus, 0, 3);
+  int i;
+
+  for (i = 0; i < (int)word->len; i++) {
+    if (uniform(corpus, 100) < 30) {
+      len = append_str(buf, len, &utf8_letters[uniform(corpus, NUM_UTF8_LETTERS)]);
+    } else {
+      len = append_char(buf, len, word->str[i]);
+    }
+  }
+  for (i = 0; i < ndigits; i++) {
+    len = append_char(buf, len, (char)('0' + uniform(corpus, 10)));
+  }
+  if (uniform(corpus, 100) < 50) {
+    len = append_char(buf, len, symbols[uniform(corpus, sizeof(symbols) - 1)]);
+  }
+  return len;
+}
+
+void pp_corpus_init(PPCorpus *corpus, uint64_t seed) {
+  int i;
+
+  /* splitmix64 spreads the seed over the whole state */
+  for (i = 0; i < 4; i++) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    corpus->state[i] = z ^ (z >> 31);
+  }
+}
+
+/*
+ * pp_corpus_next_kind
+ *
+ * writes the next password of the given kind into buf, which must hold
+ * PP_CORPUS_MAX_LEN bytes, NUL terminates it and returns its length
+ */
+size_t pp_corpus_next_kind(PPCorpus *corpus, char *buf, PPCorpusKind kind) {
+  /*
+   * buf may alias anything, so every byte written to it would make the
+   * compiler reload and store the state; a local copy stays in registers
+   */
+  PPCorpus local = *corpus;
+  size_t len;
+
+  switch (kind) {
+  case PP_CORPUS_WORD_DIGITS:
+    len = gen_word_digits(&local, buf);
+    break;
+  case PP_CORPUS_KEYBOARD_WALK:
+    len = gen_keyboard_walk(&local, buf);
+    break;
+  case PP_CORPUS_PASSPHRASE:
+    len = gen_passphrase(&local, buf);
+    break;
+  case PP_CORPUS_RANDOM_SECRET:
+    len = gen_random_secret(&local, buf);
+    break;
+  default:
+    len = gen_utf8_mix(&local, buf);
+    break;
+  }
+  buf[len] = '\0';
+  *corpus = local;
+  return len;
+}
+
+/*
+ * pp_corpus_next
+ *
+ * like pp_corpus_next_kind, drawing the kind from the corpus mix; kind
+ * receives it when not NULL
+ */
+size_t pp_corpus_next(PPCorpus *corpus, char *buf, PPCorpusKind *kind) {
+  uint32_t roll = uniform(corpus, 100);
+  int k = 0;
+
+  while (k < PP_CORPUS_NUM_KINDS - 1 && roll >= (uint32_t)kind_weights[k]) {
+    roll -= (uint32_t)kind_weights[k];
+    k++;
+  }
+  if (kind != NULL) {
+    *kind = (PPCorpusKind)k;
+  }
+  return pp_corpus_next_kind(corpus, buf, (PPCorpusKind)k);
+}
+
+const char *pp_corpus_kind_name(PPCorpusKind kind) {
+  if (kind < 0 || kind >= PP_CORPUS_NUM_KINDS) {
+    return "unknown";
+  }
+  return kind_names[kind];
+}
@@ -0,0 +1,45 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_corpus.h
+ *
+ * Deterministic generator of synthetic password corpora.
+ *
+ * Benchmarks and regression tests need realistic passwords without
+ * shipping leaked ones. The same seed always yields the same corpus, on
+ * every platform. Like pp_validate.h, nothing in here depends on the
+ * backend.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PP_CORPUS_H
+#define PP_CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* buffers handed to pp_corpus_next must hold this many bytes */
+#define PP_CORPUS_MAX_LEN 128
+
+typedef enum PPCorpusKind {
+  PP_CORPUS_WORD_DIGITS = 0,
+  PP_CORPUS_KEYBOARD_WALK,
+  PP_CORPUS_PASSPHRASE,
+  PP_CORPUS_RANDOM_SECRET,
+  PP_CORPUS_UTF8_MIX,
+  PP_CORPUS_NUM_KINDS
+} PPCorpusKind;
+
+typedef struct PPCorpus {
+  uint64_t state[4];
+} PPCorpus;
+
+extern void pp_corpus_init(PPCorpus *corpus, uint64_t seed);
+extern size_t pp_corpus_next(PPCorpus *corpus, char *buf, PPCorpusKind *kind);
+extern size_t pp_corpus_next_kind(PPCorpus *corpus, char *buf,
+                                  PPCorpusKind kind);
+extern const char *pp_corpus_kind_name(PPCorpusKind kind);
+
+#endif /* PP_CORPUS_H */
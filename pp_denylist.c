@@ -0,0 +1,1118 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_denylist.c
+ *
+ * Denylists of words managed with SQL.
+ *
+ * Words belong to named lists, such as common passwords, company terms or
+ * mildly weak words, and every list either rejects passwords containing
+ * its words or only warns about them. passwordpolicy_list_set and
+ * passwordpolicy_list_drop define the lists, passwordpolicy_deny_add and
+ * passwordpolicy_deny_remove change their words.
+ *
+ * The passwordpolicy_lists and passwordpolicy_denylist tables keep them
+ * across restarts. When the transaction commits, the changes are applied
+ * to a single dshash table in dynamic shared memory that check_password
+ * probes: a word in several lists has one entry with a bit per list, so
+ * one probe answers for all of them. The hash table grows as words are
+ * added, up to p_policy.denylist_max_words, and lookups only take a shared
+ * lock on one partition.
+ *
+ * With p_policy.wal_log_changes set, the changes are also written to WAL
+ * before they are applied, so standbys apply them to their own index once
+ * the transaction commits, see pp_wal.c.
+ *
+ * Frequently matched words are also kept in the hot tier, see pp_hot.c.
+ *
+ * Words are matched case insensitively (ASCII) anywhere in the password.
+ * The worker loads the tables into shared memory after startup; until then
+ * the denylist stage does not run.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "access/xact.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
+#include "commands/dbcommands.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "nodes/pg_list.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+#include "passwordpolicy.h"
+
+/* the folded word padded with zeroes, the key of the index */
+#define PP_DENY_KEY_SIZE (PP_MAX_PATTERN_LEN + 1)
+
+/* entry of the index */
+typedef struct PPDenyEntry {
+  char word[PP_DENY_KEY_SIZE];
+  /* bitmask of the lists containing the word */
+  uint32 lists;
+} PPDenyEntry;
+
+typedef enum PPDenyChangeKind {
+  PP_CHANGE_ADD = 0,
+  PP_CHANGE_REMOVE,
+  PP_CHANGE_LIST_SET,
+  PP_CHANGE_LIST_DROP
+} PPDenyChangeKind;
+
+/* a change to apply to shared memory when the transaction commits */
+typedef struct PPDenyChange {
+  PPDenyChangeKind kind;
+  SubTransactionId subid;
+  int list;
+  PPListAction action;
+  char name[NAMEDATALEN];
+  char word[PP_DENY_KEY_SIZE];
+} PPDenyChange;
+
+static const char *const action_names[] = {"reject", "warn"};
+
+/* this backend's mapping of the index, allocated in denylist_context */
+static MemoryContext denylist_context = NULL;
+static dsa_area *denylist_area = NULL;
+static dshash_table *denylist_table = NULL;
+
+/* changes of the current transaction, allocated in TopTransactionContext */
+static List *pending_changes = NIL;
+
+/* the pending changes in order, logged before the commit and applied after */
+static PPDenyChange *committing_changes = NULL;
+static int ncommitting_changes = 0;
+static bool callbacks_registered = false;
+
+PG_FUNCTION_INFO_V1(passwordpolicy_deny_add);
+PG_FUNCTION_INFO_V1(passwordpolicy_deny_remove);
+PG_FUNCTION_INFO_V1(passwordpolicy_list_set);
+PG_FUNCTION_INFO_V1(passwordpolicy_list_drop);
+PG_FUNCTION_INFO_V1(passwordpolicy_list_stats);
+
+static inline char fold_char(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static void denylist_params(dshash_parameters *params) {
+  memset(params, 0, sizeof(*params));
+  params->key_size = PP_DENY_KEY_SIZE;
+  params->entry_size = sizeof(PPDenyEntry);
+  params->compare_function = dshash_memcmp;
+  params->hash_function = dshash_memhash;
+  params->tranche_id = pp_shared->dsa_tranche_id;
+}
+
+/*
+ * attaches to the index, or creates it when create is set and nobody did
+ * so far; the mapping lives until pp_denylist_detach
+ */
+static bool denylist_attach(bool create) {
+  dshash_parameters params;
+  MemoryContext oldcontext;
+
+  if (denylist_table != NULL) {
+    return true;
+  }
+
+  LWLockAcquire(pp_shared->lock, create ? LW_EXCLUSIVE : LW_SHARED);
+  if (pp_shared->denylist_area == DSA_HANDLE_INVALID && !create) {
+    LWLockRelease(pp_shared->lock);
+    return false;
+  }
+
+  LWLockRegisterTranche(pp_shared->dsa_tranche_id, "passwordpolicy_denylist");
+  denylist_params(&params);
+  if (denylist_context == NULL) {
+    denylist_context = AllocSetContextCreate(
+        pp_backend_context(), "passwordpolicy denylist", ALLOCSET_SMALL_SIZES);
+  }
+  oldcontext = MemoryContextSwitchTo(denylist_context);
+  if (pp_shared->denylist_area == DSA_HANDLE_INVALID) {
+    denylist_area = dsa_create(pp_shared->dsa_tranche_id);
+    dsa_pin(denylist_area);
+    dsa_pin_mapping(denylist_area);
+    denylist_table = dshash_create(denylist_area, &params, NULL);
+    pp_shared->denylist_area = dsa_get_handle(denylist_area);
+    pp_shared->denylist_hash = dshash_get_hash_table_handle(denylist_table);
+  } else {
+    denylist_area = dsa_attach(pp_shared->denylist_area);
+    dsa_pin_mapping(denylist_area);
+    denylist_table =
+        dshash_attach(denylist_area, &params, pp_shared->denylist_hash, NULL);
+  }
+  MemoryContextSwitchTo(oldcontext);
+
+  LWLockRelease(pp_shared->lock);
+  return true;
+}
+
+/*
+ * pp_denylist_detach
+ *
+ * drops this backend's mapping of the index, the next lookup attaches
+ * again
+ */
+void pp_denylist_detach(void) {
+  if (denylist_table == NULL) {
+    return;
+  }
+
+  dshash_detach(denylist_table);
+  dsa_detach(denylist_area);
+  denylist_table = NULL;
+  denylist_area = NULL;
+  MemoryContextReset(denylist_context);
+}
+
+/*
+ * pp_denylist_area
+ *
+ * returns this backend's mapping of the dynamic shared memory area of the
+ * index, NULL if there is no index yet and create is not set
+ */
+dsa_area *pp_denylist_area(bool create) {
+  if (!denylist_attach(create)) {
+    return NULL;
+  }
+  return denylist_area;
+}
+
+/*
+ * pp_denylist_size
+ *
+ * estimates the bytes the index takes in dynamic shared memory: an item
+ * header, the entry and a bucket per word
+ */
+Size pp_denylist_size(void) {
+  Size per_word = MAXALIGN(sizeof(dsa_pointer) + sizeof(dshash_hash)) +
+                  MAXALIGN(sizeof(PPDenyEntry)) + sizeof(dsa_pointer);
+
+  if (pp_shared == NULL) {
+    return 0;
+  }
+  return (Size)pg_atomic_read_u32(&pp_shared->denylist_entries) * per_word;
+}
+
+/*
+ * recompute the length bounds and the reject mask, pp_shared->lock must be
+ * held exclusively
+ */
+static void update_bounds(void) {
+  uint32 reject = 0;
+  int len;
+  int i;
+
+  pp_shared->denylist_min_len = 0;
+  pp_shared->denylist_max_len = 0;
+  for (len = 1; len <= PP_MAX_PATTERN_LEN; len++) {
+    if (pp_shared->denylist_lengths[len] > 0) {
+      if (pp_shared->denylist_min_len == 0) {
+        pp_shared->denylist_min_len = len;
+      }
+      pp_shared->denylist_max_len = len;
+    }
+  }
+
+  for (i = 0; i < PP_MAX_LISTS; i++) {
+    if (pp_shared->lists[i].used &&
+        pp_shared->lists[i].action == PP_LIST_REJECT) {
+      reject |= UINT32_C(1) << i;
+    }
+  }
+  pg_atomic_write_u32(&pp_shared->reject_lists, reject);
+}
+
+/* forget an entry the last list let go of, pp_shared->lock must be held */
+static void forget_entry(const char *word) {
+  pp_shared->denylist_lengths[strlen(word)]--;
+  pg_atomic_fetch_sub_u32(&pp_shared->denylist_entries, 1);
+}
+
+/* add or remove a word of a list, pp_shared->lock must be held */
+static void apply_word(bool add, const char *word, int list) {
+  char key[PP_DENY_KEY_SIZE];
+  uint32 bit = UINT32_C(1) << list;
+  PPDenyEntry *entry;
+
+  memset(key, 0, sizeof(key));
+  strlcpy(key, word, sizeof(key));
+
+  if (add) {
+    bool found;
+
+    entry = dshash_find_or_insert(denylist_table, key, &found);
+    if (!found) {
+      entry->lists = 0;
+      pp_shared->denylist_lengths[strlen(word)]++;
+      pg_atomic_fetch_add_u32(&pp_shared->denylist_entries, 1);
+    }
+    if ((entry->lists & bit) == 0) {
+      entry->lists |= bit;
+      pp_shared->lists[list].words++;
+    }
+    dshash_release_lock(denylist_table, entry);
+    return;
+  }
+
+  entry = dshash_find(denylist_table, key, true);
+  if (entry == NULL) {
+    return;
+  }
+  if ((entry->lists & bit) != 0) {
+    entry->lists &= ~bit;
+    pp_shared->lists[list].words--;
+  }
+  if (entry->lists == 0) {
+    dshash_delete_entry(denylist_table, entry);
+    forget_entry(word);
+  } else {
+    dshash_release_lock(denylist_table, entry);
+  }
+}
+
+/* drop a list and its bit from every entry, pp_shared->lock must be held */
+static void apply_list_drop(int list) {
+  uint32 bit = UINT32_C(1) << list;
+  dshash_seq_status status;
+  PPDenyEntry *entry;
+
+  dshash_seq_init(&status, denylist_table, true);
+  while ((entry = dshash_seq_next(&status)) != NULL) {
+    if ((entry->lists & bit) == 0) {
+      continue;
+    }
+    entry->lists &= ~bit;
+    if (entry->lists == 0) {
+      forget_entry(entry->word);
+      dshash_delete_current(&status);
+    }
+  }
+  dshash_seq_term(&status);
+
+  pp_shared->lists[list].used = false;
+  pp_shared->lists[list].words = 0;
+}
+
+/* define or change a list, pp_shared->lock must be held */
+static void apply_list_set(int list, const char *name, PPListAction action) {
+  PPList *l = &pp_shared->lists[list];
+
+  if (!l->used) {
+    l->words = 0;
+    pg_atomic_write_u64(&l->hits, 0);
+  }
+  l->used = true;
+  l->action = action;
+  strlcpy(l->name, name, NAMEDATALEN);
+}
+
+/* applies changes to the index in order, pp_shared->lock must be held */
+static void apply_changes_locked(const PPDenyChange *changes, int nchanges) {
+  int i;
+
+  for (i = 0; i < nchanges; i++) {
+    const PPDenyChange *change = &changes[i];
+
+    switch (change->kind) {
+    case PP_CHANGE_ADD:
+    case PP_CHANGE_REMOVE:
+      apply_word(change->kind == PP_CHANGE_ADD, change->word, change->list);
+      break;
+    case PP_CHANGE_LIST_SET:
+      apply_list_set(change->list, change->name, change->action);
+      break;
+    case PP_CHANGE_LIST_DROP:
+      apply_list_drop(change->list);
+      break;
+    }
+  }
+  update_bounds();
+  pg_atomic_fetch_add_u64(&pp_shared->denylist_generation, 1);
+}
+
+/* applies changes to the index in order */
+static void apply_changes(const PPDenyChange *changes, int nchanges) {
+  (void)denylist_attach(true);
+  LWLockAcquire(pp_shared->lock, LW_EXCLUSIVE);
+  apply_changes_locked(changes, nchanges);
+  LWLockRelease(pp_shared->lock);
+
+  /* have the worker build the fuzzy trie again */
+  pp_wake_worker();
+}
+
+/*
+ * logs the changes of the committing transaction, and maps the index and
+ * copies them for apply_pending_changes while failing is still allowed
+ */
+static void log_pending_changes(void) {
+  MemoryContext oldcontext;
+  ListCell *lc;
+
+  if (pending_changes == NIL) {
+    return;
+  }
+
+  (void)denylist_attach(true);
+
+  oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+  committing_changes = (PPDenyChange *)palloc(sizeof(PPDenyChange) *
+                                              list_length(pending_changes));
+  MemoryContextSwitchTo(oldcontext);
+  ncommitting_changes = 0;
+  foreach (lc, pending_changes) {
+    committing_changes[ncommitting_changes++] = *(PPDenyChange *)lfirst(lc);
+  }
+
+  pp_wal_log(XLOG_PP_DENYLIST, (char *)committing_changes,
+             sizeof(PPDenyChange) * ncommitting_changes);
+}
+
+/*
+ * applies the changes of the transaction that just committed; a commit
+ * failing after PRE_COMMIT, such as on a serialization failure, leaves the
+ * index alone
+ */
+static void apply_pending_changes(void) {
+  if (committing_changes == NULL) {
+    return;
+  }
+  apply_changes(committing_changes, ncommitting_changes);
+}
+
+/*
+ * pp_denylist_redo
+ *
+ * applies the changes of a transaction logged by another server, or by
+ * this one before a crash, once it committed; called by the worker, see
+ * pp_wal_apply
+ */
+void pp_denylist_redo(const char *data, Size len) {
+  if (len % sizeof(PPDenyChange) != 0) {
+    elog(LOG, "passwordpolicy skips a corrupt denylist record.");
+    return;
+  }
+  apply_changes((const PPDenyChange *)data, len / sizeof(PPDenyChange));
+}
+
+static void denylist_xact_callback(XactEvent event, void *arg) {
+  switch (event) {
+  case XACT_EVENT_PRE_COMMIT:
+  case XACT_EVENT_PARALLEL_PRE_COMMIT:
+    log_pending_changes();
+    break;
+  case XACT_EVENT_PRE_PREPARE:
+    if (pending_changes != NIL) {
+      ereport(ERROR,
+              (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+               errmsg("cannot PREPARE a transaction that changed the "
+                      "passwordpolicy denylists.")));
+    }
+    break;
+  case XACT_EVENT_COMMIT:
+  case XACT_EVENT_PARALLEL_COMMIT:
+    apply_pending_changes();
+    /* the changes go away with TopTransactionContext */
+    pending_changes = NIL;
+    committing_changes = NULL;
+    break;
+  case XACT_EVENT_ABORT:
+  case XACT_EVENT_PARALLEL_ABORT:
+  case XACT_EVENT_PREPARE:
+    pending_changes = NIL;
+    committing_changes = NULL;
+    break;
+  }
+}
+
+static void denylist_subxact_callback(SubXactEvent event,
+                                      SubTransactionId mySubid,
+                                      SubTransactionId parentSubid,
+                                      void *arg) {
+  ListCell *lc;
+
+  if (event == SUBXACT_EVENT_COMMIT_SUB) {
+    foreach (lc, pending_changes) {
+      PPDenyChange *change = (PPDenyChange *)lfirst(lc);
+
+      if (change->subid == mySubid) {
+        change->subid = parentSubid;
+      }
+    }
+  } else if (event == SUBXACT_EVENT_ABORT_SUB) {
+    foreach (lc, pending_changes) {
+      PPDenyChange *change = (PPDenyChange *)lfirst(lc);
+
+      if (change->subid == mySubid) {
+        pending_changes = foreach_delete_current(pending_changes, lc);
+      }
+    }
+  }
+}
+
+static PPDenyChange *queue_change(PPDenyChangeKind kind, int list) {
+  MemoryContext oldcontext;
+  PPDenyChange *change;
+
+  if (!callbacks_registered) {
+    RegisterXactCallback(denylist_xact_callback, NULL);
+    RegisterSubXactCallback(denylist_subxact_callback, NULL);
+    callbacks_registered = true;
+  }
+
+  oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+  change = (PPDenyChange *)palloc0(sizeof(PPDenyChange));
+  change->kind = kind;
+  change->subid = GetCurrentSubTransactionId();
+  change->list = list;
+  pending_changes = lappend(pending_changes, change);
+  MemoryContextSwitchTo(oldcontext);
+
+  return change;
+}
+
+/*
+ * pp_extension_schema
+ *
+ * returns the schema passwordpolicy is installed in, or NULL when it is
+ * not installed in the current database; must be called while connected
+ * to SPI, the result is allocated in the caller's context
+ */
+char *pp_extension_schema(void) {
+  char *schema = NULL;
+  int ret;
+
+  ret = SPI_execute("SELECT n.nspname FROM pg_catalog.pg_extension e "
+                    "JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+                    "WHERE e.extname = 'passwordpolicy'",
+                    true, 1);
+  if (ret != SPI_OK_SELECT) {
+    elog(ERROR, "SPI_execute failed: error code %d.", ret);
+  }
+  if (SPI_processed > 0) {
+    char *value = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+
+    schema = (char *)SPI_palloc(strlen(value) + 1);
+    strcpy(schema, value);
+  }
+  return schema;
+}
+
+static PPListAction parse_action(const char *action) {
+  if (strcmp(action, "warn") == 0) {
+    return PP_LIST_WARN;
+  }
+  return PP_LIST_REJECT;
+}
+
+/* runs a query while loading, failing on anything but SELECT */
+static void load_query(const char *fmt, const char *schema) {
+  int ret = SPI_execute(psprintf(fmt, schema), true, 0);
+
+  if (ret != SPI_OK_SELECT) {
+    elog(ERROR, "SPI_execute failed: error code %d.", ret);
+  }
+}
+
+/*
+ * pp_denylist_load
+ *
+ * copies the passwordpolicy_lists and passwordpolicy_denylist tables into
+ * shared memory, called by the worker once it is connected to
+ * p_policy.database and until the tables exist, since the extension may
+ * be created after startup; returns whether the denylists are loaded
+ *
+ * The tables are read into a list of changes without any lock held, and
+ * the changes are applied under the lock. On a standby, or after a crash,
+ * replayed changes of transactions the snapshot sees are in the tables
+ * already; they are marked so, and the others are applied on top.
+ */
+bool pp_denylist_load(void) {
+  PPDenyChange *changes = NULL;
+  int nchanges = 0;
+  char *schema;
+  uint64 i;
+
+  if (pp_shared->denylist_loaded) {
+    return true;
+  }
+
+  (void)denylist_attach(true);
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  SPI_connect();
+  PushActiveSnapshot(GetTransactionSnapshot());
+
+  schema = pp_extension_schema();
+  if (schema == NULL ||
+      !OidIsValid(get_relname_relid("passwordpolicy_lists",
+                                    get_namespace_oid(schema, false)))) {
+    /* deny_add refuses until then, its list would not be known */
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+    return false;
+  }
+  schema = (char *)quote_identifier(schema);
+
+  /* allocated outside of SPI, the changes outlive the queries */
+  load_query("SELECT id, name, action FROM %s.passwordpolicy_lists", schema);
+  changes = (PPDenyChange *)SPI_palloc(sizeof(PPDenyChange) *
+                                       Max(SPI_processed, 1));
+  for (i = 0; i < SPI_processed; i++) {
+    HeapTuple tuple = SPI_tuptable->vals[i];
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    int list = atoi(SPI_getvalue(tuple, tupdesc, 1));
+
+    if (list >= 0 && list < PP_MAX_LISTS) {
+      PPDenyChange *change = &changes[nchanges++];
+
+      memset(change, 0, sizeof(*change));
+      change->kind = PP_CHANGE_LIST_SET;
+      change->list = list;
+      change->action = parse_action(SPI_getvalue(tuple, tupdesc, 3));
+      strlcpy(change->name, SPI_getvalue(tuple, tupdesc, 2), NAMEDATALEN);
+    }
+  }
+
+  load_query("SELECT d.word, l.id FROM %1$s.passwordpolicy_denylist d "
+             "JOIN %1$s.passwordpolicy_lists l ON l.name = d.list",
+             schema);
+  changes = (PPDenyChange *)repalloc(
+      changes, sizeof(PPDenyChange) * (nchanges + SPI_processed + 1));
+  for (i = 0; i < SPI_processed; i++) {
+    HeapTuple tuple = SPI_tuptable->vals[i];
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    char *word = SPI_getvalue(tuple, tupdesc, 1);
+    int list = atoi(SPI_getvalue(tuple, tupdesc, 2));
+
+    if (word[0] != '\0' && strlen(word) <= PP_MAX_PATTERN_LEN &&
+        list >= 0 && list < PP_MAX_LISTS) {
+      PPDenyChange *change = &changes[nchanges++];
+
+      memset(change, 0, sizeof(*change));
+      change->kind = PP_CHANGE_ADD;
+      change->list = list;
+      strlcpy(change->word, word, sizeof(change->word));
+    }
+  }
+
+  LWLockAcquire(pp_shared->lock, LW_EXCLUSIVE);
+  apply_changes_locked(changes, nchanges);
+  pp_wal_skip_visible(denylist_area, GetActiveSnapshot());
+  pp_shared->denylist_loaded = true;
+  LWLockRelease(pp_shared->lock);
+
+  SPI_finish();
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+
+  elog(LOG, "passwordpolicy loaded %u denied words.",
+       pg_atomic_read_u32(&pp_shared->denylist_entries));
+  return true;
+}
+
+/* whether check_password can probe the denylists */
+bool pp_denylist_ready(void) {
+  return pp_shared != NULL && pp_shared->denylist_loaded &&
+         pg_atomic_read_u32(&pp_shared->denylist_entries) > 0;
+}
+
+/*
+ * pp_denylist_check
+ *
+ * scans the hot tier and, unless it rejects the password, looks every
+ * substring of the password that is as long as some denied word up in the
+ * index; matches are counted for the hot tier when observe is set
+ *
+ * result: receives the lists whose words the password contains, the number
+ *			of lookups in the index and the tier that answered
+ */
+void pp_denylist_check(const char *password, bool observe,
+                       PPStageResult *result) {
+  char key[PP_DENY_KEY_SIZE];
+  int len = (int)strlen(password);
+  char *folded;
+  int minlen, maxlen;
+  int i, j;
+
+  result->lists = 0;
+  result->probes = 0;
+  result->cache_tier = "shared";
+  if (!denylist_attach(false)) {
+    return;
+  }
+
+  /* the bounds only move while words are added or removed concurrently */
+  minlen = pp_shared->denylist_min_len;
+  maxlen = pp_shared->denylist_max_len;
+  if (minlen == 0) {
+    return;
+  }
+
+  folded = palloc(len + 1);
+  for (i = 0; i < len; i++) {
+    folded[i] = fold_char(password[i]);
+  }
+  folded[len] = '\0';
+
+  result->lists = pp_hot_check(folded, observe);
+  if (pp_denylist_verdict(result->lists) != PP_RULE_OK) {
+    result->cache_tier = "hot";
+    if (observe) {
+      pp_count(PP_COUNTER_HOT_TIER);
+    }
+    explicit_bzero(folded, len);
+    pfree(folded);
+    return;
+  }
+
+  for (i = 0; i + minlen <= len; i++) {
+    /* extend the key one character at a time, it stays zero padded */
+    memset(key, 0, sizeof(key));
+    for (j = 0; j < maxlen && i + j < len; j++) {
+      PPDenyEntry *entry;
+
+      key[j] = folded[i + j];
+      if (j + 1 < minlen) {
+        continue;
+      }
+
+      result->probes++;
+      entry = dshash_find(denylist_table, key, false);
+      if (entry != NULL) {
+        result->lists |= entry->lists;
+        dshash_release_lock(denylist_table, entry);
+        if (observe) {
+          pp_hot_observe(key);
+        }
+      }
+    }
+  }
+
+  explicit_bzero(key, sizeof(key));
+  explicit_bzero(folded, len);
+  pfree(folded);
+}
+
+/*
+ * pp_denylist_lookup
+ *
+ * looks a folded word up in the index, setting lists to the bitmask of
+ * the lists containing it
+ */
+bool pp_denylist_lookup(const char *word, uint32 *lists) {
+  char key[PP_DENY_KEY_SIZE];
+  PPDenyEntry *entry;
+
+  if (!denylist_attach(false)) {
+    return false;
+  }
+
+  memset(key, 0, sizeof(key));
+  strlcpy(key, word, sizeof(key));
+  entry = dshash_find(denylist_table, key, false);
+  if (entry == NULL) {
+    return false;
+  }
+  *lists = entry->lists;
+  dshash_release_lock(denylist_table, entry);
+  return true;
+}
+
+/*
+ * pp_denylist_foreach
+ *
+ * calls callback with every word of the index and its lists, holding a
+ * shared lock on the partition of the word
+ */
+void pp_denylist_foreach(pp_denylist_callback callback, void *arg) {
+  dshash_seq_status status;
+  PPDenyEntry *entry;
+
+  if (!denylist_attach(false)) {
+    return;
+  }
+
+  dshash_seq_init(&status, denylist_table, false);
+  while ((entry = dshash_seq_next(&status)) != NULL) {
+    callback(entry->word, entry->lists, arg);
+  }
+  dshash_seq_term(&status);
+}
+
+/* the verdict on a password containing words of the given lists */
+PPRule pp_denylist_verdict(uint32 lists) {
+  if (pp_shared != NULL &&
+      (lists & pg_atomic_read_u32(&pp_shared->reject_lists)) != 0) {
+    return PP_RULE_DENYLIST;
+  }
+  return PP_RULE_OK;
+}
+
+/*
+ * pp_denylist_report
+ *
+ * counts a hit for each of the lists and, if the password is accepted,
+ * warns about the lists with action warn
+ */
+void pp_denylist_report(uint32 lists, bool accepted) {
+  char warn[PP_MAX_LISTS][NAMEDATALEN];
+  int nwarn = 0;
+  int i;
+
+  if (pp_shared == NULL || lists == 0) {
+    return;
+  }
+
+  LWLockAcquire(pp_shared->lock, LW_SHARED);
+  for (i = 0; i < PP_MAX_LISTS; i++) {
+    PPList *list = &pp_shared->lists[i];
+
+    if ((lists & (UINT32_C(1) << i)) == 0 || !list->used) {
+      continue;
+    }
+    pg_atomic_fetch_add_u64(&list->hits, 1);
+    if (accepted && list->action == PP_LIST_WARN) {
+      strlcpy(warn[nwarn++], list->name, NAMEDATALEN);
+    }
+  }
+  LWLockRelease(pp_shared->lock);
+
+  for (i = 0; i < nwarn; i++) {
+    ereport(WARNING, (errcode(ERRCODE_WARNING),
+                      errmsg("password contains a word of denylist \"%s\".",
+                             warn[i])));
+  }
+}
+
+/* returns the comma separated names of the lists, NULL if there are none */
+char *pp_denylist_names(uint32 lists) {
+  StringInfoData buf;
+  int i;
+
+  if (pp_shared == NULL || lists == 0) {
+    return NULL;
+  }
+
+  initStringInfo(&buf);
+  LWLockAcquire(pp_shared->lock, LW_SHARED);
+  for (i = 0; i < PP_MAX_LISTS; i++) {
+    if ((lists & (UINT32_C(1) << i)) != 0 && pp_shared->lists[i].used) {
+      appendStringInfo(&buf, "%s%s", buf.len > 0 ? "," : "",
+                       pp_shared->lists[i].name);
+    }
+  }
+  LWLockRelease(pp_shared->lock);
+
+  return buf.len > 0 ? buf.data : NULL;
+}
+
+/* checks the denylists can be changed from this session */
+static void check_session(void) {
+  char *dbname;
+
+  pp_require_shared();
+
+  dbname = get_database_name(MyDatabaseId);
+  if (dbname == NULL || strcmp(dbname, passDatabase) != 0) {
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("passwordpolicy denylists are managed in database "
+                    "\"%s\".",
+                    passDatabase)));
+  }
+  if (!pp_shared->denylist_loaded) {
+    ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                    errmsg("passwordpolicy denylists are not loaded yet."),
+                    errhint("The passwordpolicy worker loads them after "
+                            "startup and once the extension is created.")));
+  }
+}
+
+/* folds a word given to passwordpolicy_deny_add or _remove into word */
+static void fold_word(text *arg, char *word) {
+  char *str = text_to_cstring(arg);
+  int len = (int)strlen(str);
+  int i;
+
+  if (len == 0 || len > PP_MAX_PATTERN_LEN) {
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("denied words must be 1 to %d bytes long.",
+                    PP_MAX_PATTERN_LEN)));
+  }
+
+  for (i = 0; i < len; i++) {
+    word[i] = fold_char(str[i]);
+  }
+  word[len] = '\0';
+  pfree(str);
+}
+
+/*
+ * runs sql, with %s replaced by the extension schema, on the arguments;
+ * must be called while connected to SPI, returns the rows processed
+ */
+static uint64 run_sql(const char *fmt, int nargs, Datum *values, int expected) {
+  Oid argtypes[2] = {TEXTOID, TEXTOID};
+  char *schema = pp_extension_schema();
+  int ret;
+
+  if (schema == NULL) {
+    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+                    errmsg("extension \"passwordpolicy\" is not installed.")));
+  }
+
+  ret = SPI_execute_with_args(psprintf(fmt, quote_identifier(schema)), nargs,
+                              argtypes, values, NULL, false, 0);
+  if (ret != expected) {
+    elog(ERROR, "SPI_execute_with_args failed: error code %d.", ret);
+  }
+  return SPI_processed;
+}
+
+/* returns the id of a list, -1 if there is no such list */
+static int list_id(const char *name) {
+  Datum values[1];
+  bool isnull;
+
+  values[0] = CStringGetTextDatum(name);
+  if (run_sql("SELECT id FROM %s.passwordpolicy_lists WHERE name = $1", 1,
+              values, SPI_OK_SELECT) == 0) {
+    return -1;
+  }
+  return DatumGetInt32(
+      SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+}
+
+static int existing_list_id(const char *name) {
+  int list = list_id(name);
+
+  if (list < 0) {
+    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+                    errmsg("denylist \"%s\" does not exist.", name)));
+  }
+  return list;
+}
+
+/*
+ * refuses to add a word once the index holds p_policy.denylist_max_words,
+ * counting the words this transaction adds; the limit is not evicted from,
+ * a denied word silently dropped would let a weak password through
+ */
+static void check_max_words(void) {
+  uint32 words;
+  ListCell *lc;
+
+  if (passDenylistMaxWords <= 0) {
+    return;
+  }
+
+  words = pg_atomic_read_u32(&pp_shared->denylist_entries);
+  foreach (lc, pending_changes) {
+    if (((PPDenyChange *)lfirst(lc))->kind == PP_CHANGE_ADD) {
+      words++;
+    }
+  }
+  if (words >= (uint32)passDenylistMaxWords) {
+    ereport(ERROR,
+            (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+             errmsg("at most %d denied words are allowed.",
+                    passDenylistMaxWords),
+             errhint("Remove words or raise p_policy.denylist_max_words.")));
+  }
+}
+
+/* adds or removes a word of a list, returns whether the table changed */
+static bool change_word(bool add, text *word_arg, text *list_arg) {
+  char word[PP_DENY_KEY_SIZE];
+  char *name = text_to_cstring(list_arg);
+  Datum values[2];
+  bool changed;
+  int list;
+
+  check_session();
+  fold_word(word_arg, word);
+  if (add) {
+    check_max_words();
+  }
+
+  SPI_connect();
+  list = existing_list_id(name);
+  values[0] = CStringGetTextDatum(word);
+  values[1] = CStringGetTextDatum(name);
+  if (add) {
+    changed = run_sql("INSERT INTO %s.passwordpolicy_denylist (word, list) "
+                      "VALUES ($1, $2) ON CONFLICT DO NOTHING",
+                      2, values, SPI_OK_INSERT) > 0;
+  } else {
+    changed = run_sql("DELETE FROM %s.passwordpolicy_denylist "
+                      "WHERE word = $1 AND list = $2",
+                      2, values, SPI_OK_DELETE) > 0;
+  }
+  SPI_finish();
+
+  if (changed) {
+    PPDenyChange *change =
+        queue_change(add ? PP_CHANGE_ADD : PP_CHANGE_REMOVE, list);
+
+    strlcpy(change->word, word, sizeof(change->word));
+  }
+  return changed;
+}
+
+/*
+ * passwordpolicy_deny_add
+ *
+ * adds a word to a list, returns false if it was there already
+ */
+Datum passwordpolicy_deny_add(PG_FUNCTION_ARGS) {
+  PG_RETURN_BOOL(change_word(true, PG_GETARG_TEXT_PP(0), PG_GETARG_TEXT_PP(1)));
+}
+
+/*
+ * passwordpolicy_deny_remove
+ *
+ * removes a word from a list, returns false if it was not there
+ */
+Datum passwordpolicy_deny_remove(PG_FUNCTION_ARGS) {
+  PG_RETURN_BOOL(
+      change_word(false, PG_GETARG_TEXT_PP(0), PG_GETARG_TEXT_PP(1)));
+}
+
+/*
+ * passwordpolicy_list_set
+ *
+ * creates a list or changes its action, "reject" or "warn"
+ */
+Datum passwordpolicy_list_set(PG_FUNCTION_ARGS) {
+  char *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  char *action = text_to_cstring(PG_GETARG_TEXT_PP(1));
+  PPDenyChange *change;
+  Datum values[2];
+  bool isnull;
+  int list;
+
+  check_session();
+  if (strcmp(action, "reject") != 0 && strcmp(action, "warn") != 0) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("denylist action must be \"reject\" or \"warn\".")));
+  }
+  if (name[0] == '\0' || strlen(name) >= NAMEDATALEN) {
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("denylist names must be 1 to %d bytes long.",
+                    NAMEDATALEN - 1)));
+  }
+
+  SPI_connect();
+  /* serialize the choice of a free id */
+  run_sql("LOCK TABLE %s.passwordpolicy_lists IN SHARE ROW EXCLUSIVE MODE", 0,
+          NULL, SPI_OK_UTILITY);
+
+  values[0] = CStringGetTextDatum(name);
+  values[1] = CStringGetTextDatum(action);
+  list = list_id(name);
+  if (list >= 0) {
+    run_sql("UPDATE %s.passwordpolicy_lists SET action = $2 WHERE name = $1",
+            2, values, SPI_OK_UPDATE);
+  } else {
+    Datum id;
+
+    run_sql("SELECT min(i) FROM generate_series(0, 31) i WHERE i NOT IN "
+            "(SELECT id FROM %s.passwordpolicy_lists)",
+            0, NULL, SPI_OK_SELECT);
+    id = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1,
+                       &isnull);
+    if (isnull) {
+      ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                      errmsg("at most %d denylists are allowed.",
+                             PP_MAX_LISTS)));
+    }
+    list = DatumGetInt32(id);
+    run_sql(psprintf("INSERT INTO %%s.passwordpolicy_lists (name, id, action) "
+                     "VALUES ($1, %d, $2)",
+                     list),
+            2, values, SPI_OK_INSERT);
+  }
+  SPI_finish();
+
+  change = queue_change(PP_CHANGE_LIST_SET, list);
+  change->action = parse_action(action);
+  strlcpy(change->name, name, NAMEDATALEN);
+
+  PG_RETURN_VOID();
+}
+
+/*
+ * passwordpolicy_list_drop
+ *
+ * drops a list with all its words, returns false if there was no such list
+ */
+Datum passwordpolicy_list_drop(PG_FUNCTION_ARGS) {
+  char *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  Datum values[1];
+  int list;
+
+  check_session();
+
+  SPI_connect();
+  list = list_id(name);
+  if (list >= 0) {
+    /* the words go with it, ON DELETE CASCADE */
+    values[0] = CStringGetTextDatum(name);
+    run_sql("DELETE FROM %s.passwordpolicy_lists WHERE name = $1", 1, values,
+            SPI_OK_DELETE);
+  }
+  SPI_finish();
+
+  if (list < 0) {
+    PG_RETURN_BOOL(false);
+  }
+  (void)queue_change(PP_CHANGE_LIST_DROP, list);
+  PG_RETURN_BOOL(true);
+}
+
+/*
+ * passwordpolicy_list_stats
+ *
+ * returns one row per list with its action, the number of words in it and
+ * the number of passwords that contained one of them
+ */
+Datum passwordpolicy_list_stats(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  int i;
+
+  pp_require_shared();
+  InitMaterializedSRF(fcinfo, 0);
+
+  LWLockAcquire(pp_shared->lock, LW_SHARED);
+  for (i = 0; i < PP_MAX_LISTS; i++) {
+    PPList *list = &pp_shared->lists[i];
+    Datum values[4];
+    bool nulls[4] = {false, false, false, false};
+
+    if (!list->used) {
+      continue;
+    }
+    values[0] = CStringGetTextDatum(list->name);
+    values[1] = CStringGetTextDatum(action_names[list->action]);
+    values[2] = Int64GetDatum((int64)list->words);
+    values[3] = Int64GetDatum((int64)pg_atomic_read_u64(&list->hits));
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+  LWLockRelease(pp_shared->lock);
+
+  return (Datum)0;
+}
@@ -0,0 +1,138 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_expiry.c
+ *
+ * Password expiry.
+ *
+ * With p_policy.max_valid_days set, every password must be given a VALID
+ * UNTIL date no further ahead than that. check_password receives the date
+ * of the statement, or the current one of the role, so this is a single
+ * comparison.
+ *
+ * The worker also scans pg_authid every p_policy.expiry_check_interval for
+ * login roles expiring within p_policy.expiry_warning_days, with a single
+ * query that keeps the passwordpolicy_expiring_roles table in
+ * p_policy.database up to date and sends a notification on the
+ * passwordpolicy_expiring channel for every role that is new to it, or
+ * whose date changed.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+#include "passwordpolicy.h"
+
+/*
+ * pp_expiry_limit
+ *
+ * returns the latest VALID UNTIL date a password set now may have, 0 if
+ * p_policy.max_valid_days is not set
+ */
+TimestampTz pp_expiry_limit(void) {
+  if (passMaxValidDays <= 0) {
+    return 0;
+  }
+  return GetCurrentTimestamp() + (TimestampTz)passMaxValidDays * USECS_PER_DAY;
+}
+
+/*
+ * pp_expiry_check
+ *
+ * ereport's if the password is valid for longer than
+ * p_policy.max_valid_days
+ *
+ * validuntil_time: password expiration time, as a timestamptz Datum
+ * validuntil_null: true if password expiration time is NULL
+ */
+void pp_expiry_check(Datum validuntil_time, bool validuntil_null) {
+  TimestampTz limit = pp_expiry_limit();
+
+  if (limit == 0) {
+    return;
+  }
+
+  if (validuntil_null || DatumGetTimestampTz(validuntil_time) > limit) {
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("password must expire within %d days.", passMaxValidDays),
+             errhint("Set VALID UNTIL to a date before %s.",
+                     timestamptz_to_str(limit))));
+  }
+}
+
+/*
+ * pp_expiry_scan
+ *
+ * records the login roles expiring within p_policy.expiry_warning_days in
+ * passwordpolicy_expiring_roles and notifies the new ones, called by the
+ * worker
+ */
+void pp_expiry_scan(void) {
+  char *schema;
+
+  if (RecoveryInProgress()) {
+    return;
+  }
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  SPI_connect();
+  PushActiveSnapshot(GetTransactionSnapshot());
+
+  schema = pp_extension_schema();
+  if (schema != NULL &&
+      OidIsValid(get_relname_relid("passwordpolicy_expiring_roles",
+                                   get_namespace_oid(schema, false)))) {
+    const char *table = quote_qualified_identifier(
+        schema, "passwordpolicy_expiring_roles");
+    /* the final SELECT sees the table as it was before the statement */
+    char *sql = psprintf(
+        "WITH expiring AS ("
+        " SELECT rolname, rolvaliduntil FROM pg_catalog.pg_authid"
+        " WHERE rolcanlogin"
+        " AND rolvaliduntil < now() + make_interval(days => $1)),"
+        " gone AS ("
+        " DELETE FROM %s r"
+        " WHERE NOT EXISTS (SELECT 1 FROM expiring e"
+        " WHERE e.rolname = r.role)),"
+        " saved AS ("
+        " INSERT INTO %s AS r (role, valid_until, noticed_at)"
+        " SELECT rolname, rolvaliduntil, now() FROM expiring"
+        " ON CONFLICT (role) DO UPDATE"
+        " SET valid_until = excluded.valid_until,"
+        " noticed_at = excluded.noticed_at"
+        " WHERE r.valid_until <> excluded.valid_until)"
+        " SELECT pg_catalog.pg_notify('passwordpolicy_expiring', e.rolname)"
+        " FROM expiring e"
+        " WHERE NOT EXISTS (SELECT 1 FROM %s r WHERE r.role = e.rolname"
+        " AND r.valid_until = e.rolvaliduntil)",
+        table, table, table);
+    Oid argtypes[1] = {INT4OID};
+    Datum values[1];
+    int ret;
+
+    values[0] = Int32GetDatum(passExpiryWarningDays);
+    ret = SPI_execute_with_args(sql, 1, argtypes, values, NULL, false, 0);
+    if (ret != SPI_OK_SELECT) {
+      elog(ERROR, "SPI_execute_with_args failed: error code %d.", ret);
+    }
+    elog(DEBUG1, "passwordpolicy found " UINT64_FORMAT
+                 " newly expiring roles.",
+         SPI_processed);
+  }
+
+  SPI_finish();
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+}
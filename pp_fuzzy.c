@@ -0,0 +1,310 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_fuzzy.c
+ *
+ * Fuzzy matching of the denylists.
+ *
+ * Users get around exact matches with a typo or a swapped character, such
+ * as passw0rdd. With p_policy.fuzzy_max_distance set, passwords are also
+ * rejected when a part of them is within that many edits of a denied word.
+ *
+ * The worker flattens the index into a trie in the dynamic shared memory
+ * area of the index, and builds a new one whenever the denylists change,
+ * so the cost of building it is paid once for all backends; until the new
+ * trie replaces the old one, fuzzy matching uses the words it had. The
+ * trie takes 16 bytes per node, at most one node per character of the
+ * words. The password is matched against all words at
+ * once: walking the trie depth first, every node computes one row of the
+ * edit distances between its prefix and the substrings of the password,
+ * from the row of its parent, and subtrees whose rows exceed the distance
+ * are skipped. The rows are the states of a Levenshtein automaton, so the
+ * work depends on the password and on how many prefixes come close to it,
+ * not on the number of words.
+ *
+ * Short words would match almost anything, so a word allows one edit per
+ * four characters, up to the configured distance.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "utils/dsa.h"
+#include "utils/memutils.h"
+
+#include "passwordpolicy.h"
+
+/* longer passwords only get the exact checks */
+#define PP_FUZZY_MAX_LEN 256
+
+/* characters of a word per edit it allows */
+#define PP_FUZZY_CHARS_PER_EDIT 4
+
+/* node of the trie, node 0 is the root */
+typedef struct PPTrieNode {
+  int32 child;   /* first child, -1 if none */
+  int32 sibling; /* next child of the parent, -1 if none */
+  uint32 lists;  /* lists of the word ending here, 0 if none */
+  char c;
+} PPTrieNode;
+
+/* a trie being built by the worker, in its own memory */
+typedef struct PPTrieBuild {
+  PPTrieNode *nodes;
+  int32 count;
+  int32 capacity;
+} PPTrieBuild;
+
+/* state of a walk over the trie */
+typedef struct PPFuzzyWalk {
+  const PPTrieNode *trie;
+  const char *password;
+  int len;
+  int max_distance;
+  /* a row of len + 1 distances per depth */
+  uint8 *rows;
+  uint32 lists;
+  int64 visited;
+} PPFuzzyWalk;
+
+static int32 trie_new_node(PPTrieBuild *build, char c) {
+  PPTrieNode *node;
+
+  if (build->count == build->capacity) {
+    build->capacity = build->capacity > 0 ? build->capacity * 2 : 1024;
+    build->nodes =
+        build->nodes == NULL
+            ? (PPTrieNode *)palloc_extended(
+                  sizeof(PPTrieNode) * build->capacity, MCXT_ALLOC_HUGE)
+            : (PPTrieNode *)repalloc_huge(
+                  build->nodes, sizeof(PPTrieNode) * build->capacity);
+  }
+
+  node = &build->nodes[build->count];
+  node->child = -1;
+  node->sibling = -1;
+  node->lists = 0;
+  node->c = c;
+  return build->count++;
+}
+
+static void trie_insert(const char *word, uint32 lists, void *arg) {
+  PPTrieBuild *build = (PPTrieBuild *)arg;
+  int32 node = 0;
+  const char *p;
+
+  for (p = word; *p != '\0'; p++) {
+    int32 child = build->nodes[node].child;
+    int32 prev = -1;
+
+    while (child >= 0 && build->nodes[child].c != *p) {
+      prev = child;
+      child = build->nodes[child].sibling;
+    }
+    if (child < 0) {
+      /* may move the nodes, only keep indexes across it */
+      child = trie_new_node(build, *p);
+      if (prev < 0) {
+        build->nodes[node].child = child;
+      } else {
+        build->nodes[prev].sibling = child;
+      }
+    }
+    node = child;
+  }
+  build->nodes[node].lists |= lists;
+}
+
+/* replaces the shared trie, the worker is its only writer */
+static void trie_publish(dsa_area *area, dsa_pointer trie, int32 nodes,
+                         uint64 generation) {
+  dsa_pointer old;
+
+  /* wait for the walks of the old trie */
+  LWLockAcquire(pp_shared->trie_lock, LW_EXCLUSIVE);
+  old = pp_shared->trie;
+  pp_shared->trie = trie;
+  pp_shared->trie_nodes = nodes;
+  pp_shared->trie_generation = generation;
+  LWLockRelease(pp_shared->trie_lock);
+
+  if (DsaPointerIsValid(old)) {
+    dsa_free(area, old);
+  }
+}
+
+/*
+ * pp_fuzzy_build
+ *
+ * flattens the index into a new shared trie if the denylists changed since
+ * the current one was built, or drops it while fuzzy matching is off;
+ * called by the worker
+ */
+void pp_fuzzy_build(void) {
+  /* read first: a change during the scan makes the next call build again */
+  uint64 generation = pg_atomic_read_u64(&pp_shared->denylist_generation);
+  dsa_area *area = pp_denylist_area(false);
+  MemoryContext context;
+  MemoryContext oldcontext;
+  PPTrieBuild build;
+  dsa_pointer trie;
+  Size size;
+
+  if (area == NULL) {
+    return;
+  }
+  if (passFuzzyMaxDistance <= 0) {
+    if (DsaPointerIsValid(pp_shared->trie)) {
+      trie_publish(area, InvalidDsaPointer, 0, 0);
+    }
+    return;
+  }
+  if (DsaPointerIsValid(pp_shared->trie) &&
+      pp_shared->trie_generation == generation) {
+    return;
+  }
+
+  context = AllocSetContextCreate(CurrentMemoryContext,
+                                  "passwordpolicy fuzzy trie",
+                                  ALLOCSET_DEFAULT_SIZES);
+  oldcontext = MemoryContextSwitchTo(context);
+  memset(&build, 0, sizeof(build));
+  (void)trie_new_node(&build, '\0');
+  pp_denylist_foreach(trie_insert, &build);
+  MemoryContextSwitchTo(oldcontext);
+
+  size = sizeof(PPTrieNode) * build.count;
+  trie = dsa_allocate_extended(area, size, DSA_ALLOC_HUGE | DSA_ALLOC_NO_OOM);
+  if (!DsaPointerIsValid(trie)) {
+    ereport(LOG, (errcode(ERRCODE_OUT_OF_MEMORY),
+                  errmsg("could not allocate %zu bytes for the passwordpolicy "
+                         "fuzzy trie.",
+                         size)));
+  } else {
+    memcpy(dsa_get_address(area, trie), build.nodes, size);
+    trie_publish(area, trie, build.count, generation);
+    elog(DEBUG1, "passwordpolicy built a fuzzy trie of %d nodes.",
+         build.count);
+  }
+  MemoryContextDelete(context);
+}
+
+static void walk(PPFuzzyWalk *w, int32 node, int depth) {
+  uint8 *prev = w->rows + (depth - 1) * (w->len + 1);
+  uint8 *row = w->rows + depth * (w->len + 1);
+  uint8 limit = (uint8)(w->max_distance + 1);
+  char c = w->trie[node].c;
+  uint8 best;
+  int32 child;
+  int j;
+
+  w->visited++;
+
+  /* row[j]: edits between the prefix and the best substring ending at j */
+  row[0] = Min(prev[0] + 1, limit);
+  best = row[0];
+  for (j = 1; j <= w->len; j++) {
+    int v = Min(prev[j] + 1, row[j - 1] + 1);
+
+    v = Min(v, prev[j - 1] + (w->password[j - 1] != c ? 1 : 0));
+    row[j] = (uint8)Min(v, limit);
+    best = Min(best, row[j]);
+  }
+
+  if (w->trie[node].lists != 0) {
+    int allowed = Min(w->max_distance, depth / PP_FUZZY_CHARS_PER_EDIT);
+
+    if (allowed > 0 && best <= allowed) {
+      w->lists |= w->trie[node].lists;
+    }
+  }
+  if (best > w->max_distance) {
+    return;
+  }
+
+  for (child = w->trie[node].child; child >= 0;
+       child = w->trie[child].sibling) {
+    walk(w, child, depth + 1);
+  }
+}
+
+/*
+ * pp_fuzzy_check
+ *
+ * looks for words of the denylists within p_policy.fuzzy_max_distance
+ * edits of a part of the password
+ *
+ * result: receives the lists of the words found and the number of trie
+ *			nodes visited
+ */
+void pp_fuzzy_check(const char *password, PPStageResult *result) {
+  PPFuzzyWalk w;
+  dsa_area *area;
+  char *folded;
+  int32 child;
+  int i;
+
+  result->lists = 0;
+  result->probes = 0;
+  w.len = (int)strlen(password);
+  if (w.len > PP_FUZZY_MAX_LEN || passFuzzyMaxDistance <= 0) {
+    return;
+  }
+  area = pp_denylist_area(false);
+  if (area == NULL) {
+    return;
+  }
+
+  folded = palloc(w.len + 1);
+  for (i = 0; i < w.len; i++) {
+    char c = password[i];
+
+    folded[i] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+  }
+  folded[w.len] = '\0';
+
+  w.password = folded;
+  w.max_distance = passFuzzyMaxDistance;
+  w.rows = (uint8 *)palloc0((PP_MAX_PATTERN_LEN + 1) * (w.len + 1));
+  w.lists = 0;
+  w.visited = 0;
+
+  /* the worker frees a replaced trie once nobody walks it */
+  LWLockAcquire(pp_shared->trie_lock, LW_SHARED);
+  if (DsaPointerIsValid(pp_shared->trie)) {
+    w.trie = (const PPTrieNode *)dsa_get_address(area, pp_shared->trie);
+
+    /* a word may start anywhere in the password, row 0 is all zeroes */
+    for (child = w.trie[0].child; child >= 0; child = w.trie[child].sibling) {
+      walk(&w, child, 1);
+    }
+  }
+  LWLockRelease(pp_shared->trie_lock);
+
+  result->lists = w.lists;
+  result->probes = w.visited;
+
+  explicit_bzero(folded, w.len);
+  explicit_bzero(w.rows, (PP_MAX_PATTERN_LEN + 1) * (w.len + 1));
+  pfree(folded);
+  pfree(w.rows);
+}
+
+/*
+ * pp_fuzzy_size
+ *
+ * returns the bytes the shared trie takes, its nodes and the generation of
+ * the denylists it was built from, false if there is none
+ */
+bool pp_fuzzy_size(int64 *size, int64 *nodes, uint64 *generation) {
+  bool built;
+
+  LWLockAcquire(pp_shared->trie_lock, LW_SHARED);
+  built = DsaPointerIsValid(pp_shared->trie);
+  *nodes = pp_shared->trie_nodes;
+  *size = (int64)sizeof(PPTrieNode) * pp_shared->trie_nodes;
+  *generation = pp_shared->trie_generation;
+  LWLockRelease(pp_shared->trie_lock);
+
+  return built;
+}
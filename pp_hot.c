@@ -0,0 +1,408 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_hot.c
+ *
+ * Hot tier of the denylists.
+ *
+ * The passwords users try are skewed: the same few weak words come back
+ * again and again. Every denylist match is counted in a count-min sketch
+ * in shared memory, and the worker periodically promotes the words with
+ * the highest counts into a small tier in the main shared memory segment.
+ * check_password scans that tier first and rejects a password containing a
+ * hot word without probing the index in dynamic shared memory. The tier
+ * holds p_policy.hot_tier_size words, colder words are evicted. The counts
+ * are halved after every promotion, so the tier follows what users try now
+ * rather than what they tried once.
+ *
+ * The worker dumps the tier to a file in the data directory every
+ * p_policy.hot_tier_dump_interval seconds and when it exits, and restores
+ * it after loading the denylists, so a restarted or promoted server starts
+ * with the tier it had. The file has no words, only hashes of them and
+ * their counts; restoring scans the index for the words with those hashes,
+ * which also pages the index in. The hashes don't hide anything from
+ * whoever can read the denylists, so the file is protected like the rest
+ * of the data directory, see pp_hot_dump.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "access/xlog.h"
+#include "common/hashfn.h"
+#include "storage/fd.h"
+
+#include "passwordpolicy.h"
+
+/* words counted less often than this never get into the tier */
+#define PP_HOT_MIN_COUNT 2
+
+/* dump of the tier, relative to the data directory */
+#define PP_HOT_DUMP_FILE "passwordpolicy.hot"
+#define PP_HOT_DUMP_TMP_FILE PP_HOT_DUMP_FILE ".tmp"
+#define PP_HOT_DUMP_MAGIC "passwordpolicy hot tier 1"
+
+typedef struct PPHotCandidate {
+  char word[PP_MAX_PATTERN_LEN + 1];
+  uint32 lists;
+  uint32 count;
+} PPHotCandidate;
+
+static inline uint32 cms_slot(const char *word, int len, int row) {
+  return (uint32)(hash_bytes_extended((const unsigned char *)word, len,
+                                      (uint64)row) %
+                  PP_CMS_WIDTH);
+}
+
+/* count a hit of word, returns its new estimated count */
+static uint32 cms_add(const char *word) {
+  int len = (int)strlen(word);
+  uint32 estimate = PG_UINT32_MAX;
+  int row;
+
+  for (row = 0; row < PP_CMS_DEPTH; row++) {
+    uint32 count = pg_atomic_add_fetch_u32(
+        &pp_shared->cms[row][cms_slot(word, len, row)], 1);
+
+    estimate = Min(estimate, count);
+  }
+  return estimate;
+}
+
+static uint32 cms_estimate(const char *word) {
+  int len = (int)strlen(word);
+  uint32 estimate = PG_UINT32_MAX;
+  int row;
+
+  for (row = 0; row < PP_CMS_DEPTH; row++) {
+    uint32 count =
+        pg_atomic_read_u32(&pp_shared->cms[row][cms_slot(word, len, row)]);
+
+    estimate = Min(estimate, count);
+  }
+  return estimate;
+}
+
+/* count a word n times, see cms_add */
+static void cms_add_n(const char *word, uint32 n) {
+  int len = (int)strlen(word);
+  int row;
+
+  for (row = 0; row < PP_CMS_DEPTH; row++) {
+    pg_atomic_fetch_add_u32(&pp_shared->cms[row][cms_slot(word, len, row)],
+                            n);
+  }
+}
+
+/*
+ * pp_hot_observe
+ *
+ * counts a match of a denylist word, suggesting it for the hot tier once it
+ * is counted as often as the coldest word in there
+ */
+void pp_hot_observe(const char *word) {
+  if (cms_add(word) < pg_atomic_read_u32(&pp_shared->hot_threshold)) {
+    return;
+  }
+
+  SpinLockAcquire(&pp_shared->candidate_lock);
+  if (pp_shared->ncandidates < PP_HOT_CANDIDATES) {
+    strlcpy(pp_shared->candidates[pp_shared->ncandidates++], word,
+            PP_MAX_PATTERN_LEN + 1);
+  }
+  SpinLockRelease(&pp_shared->candidate_lock);
+}
+
+/*
+ * pp_hot_check
+ *
+ * scans the folded password for the words in the hot tier without taking
+ * any lock, counting the matches when observe is set
+ *
+ * returns the bitmask of the lists of the hot words found, 0 while the tier
+ * is being rewritten or out of date
+ */
+uint32 pp_hot_check(const char *folded, bool observe) {
+  int matched[PP_HOT_TIER_SIZE];
+  int nmatched;
+  uint32 lists;
+  uint64 seq;
+  int i;
+
+  do {
+    seq = pg_atomic_read_u64(&pp_shared->hot_seq);
+    if ((seq & 1) != 0) {
+      return 0;
+    }
+    pg_read_barrier();
+
+    if (pp_shared->hot_generation !=
+        pg_atomic_read_u64(&pp_shared->denylist_generation)) {
+      return 0;
+    }
+
+    lists = 0;
+    nmatched = 0;
+    for (i = 0; i < pp_shared->hot_count && i < PP_HOT_TIER_SIZE; i++) {
+      /* the last byte of a word is always zero, even mid rewrite */
+      if (strstr(folded, pp_shared->hot[i].word) != NULL) {
+        lists |= pp_shared->hot[i].lists;
+        matched[nmatched++] = i;
+      }
+    }
+
+    pg_read_barrier();
+  } while (pg_atomic_read_u64(&pp_shared->hot_seq) != seq);
+
+  if (observe) {
+    for (i = 0; i < nmatched; i++) {
+      char word[PP_MAX_PATTERN_LEN + 1];
+
+      strlcpy(word, pp_shared->hot[matched[i]].word, sizeof(word));
+      (void)cms_add(word);
+    }
+  }
+  return lists;
+}
+
+static int candidate_cmp(const void *a, const void *b) {
+  const PPHotCandidate *ca = (const PPHotCandidate *)a;
+  const PPHotCandidate *cb = (const PPHotCandidate *)b;
+
+  if (ca->count != cb->count) {
+    return ca->count > cb->count ? -1 : 1;
+  }
+  return strcmp(ca->word, cb->word);
+}
+
+/*
+ * pp_hot_promote
+ *
+ * rebuilds the hot tier from its current words and the candidates, keeping
+ * the ones with the highest counts, then halves all counts; called by the
+ * worker every p_policy.hot_tier_interval seconds
+ */
+void pp_hot_promote(void) {
+  PPHotCandidate *words;
+  int nwords = 0;
+  int nhot = 0;
+  uint64 generation;
+  uint32 threshold;
+  int i, j;
+
+  words = (PPHotCandidate *)palloc0(sizeof(PPHotCandidate) *
+                                    (PP_HOT_TIER_SIZE + PP_HOT_CANDIDATES));
+
+  /* the worker is the only writer of the tier, read it as is */
+  for (i = 0; i < pp_shared->hot_count; i++) {
+    strlcpy(words[nwords++].word, pp_shared->hot[i].word,
+            PP_MAX_PATTERN_LEN + 1);
+  }
+  SpinLockAcquire(&pp_shared->candidate_lock);
+  for (i = 0; i < pp_shared->ncandidates; i++) {
+    strlcpy(words[nwords++].word, pp_shared->candidates[i],
+            PP_MAX_PATTERN_LEN + 1);
+  }
+  pp_shared->ncandidates = 0;
+  SpinLockRelease(&pp_shared->candidate_lock);
+
+  for (i = 0; i < nwords; i++) {
+    words[i].count = cms_estimate(words[i].word);
+  }
+  qsort(words, nwords, sizeof(PPHotCandidate), candidate_cmp);
+
+  /*
+   * Look the lists of the words up as of this generation; if the denylists
+   * change meanwhile, readers ignore the tier until the next promotion.
+   */
+  generation = pg_atomic_read_u64(&pp_shared->denylist_generation);
+  for (i = 0; i < nwords && nhot < passHotTierSize; i++) {
+    if (words[i].count < PP_HOT_MIN_COUNT) {
+      break;
+    }
+    /* duplicates are adjacent after sorting */
+    if (i > 0 && strcmp(words[i].word, words[i - 1].word) == 0) {
+      continue;
+    }
+    if (pp_denylist_lookup(words[i].word, &words[i].lists)) {
+      words[nhot++] = words[i];
+    }
+  }
+
+  pg_atomic_fetch_add_u64(&pp_shared->hot_seq, 1);
+  pg_write_barrier();
+  memset(pp_shared->hot, 0, sizeof(pp_shared->hot));
+  for (i = 0; i < nhot; i++) {
+    PPHotEntry *entry = &pp_shared->hot[i];
+
+    memcpy(entry->word, words[i].word, strlen(words[i].word));
+    entry->lists = words[i].lists;
+    entry->count = words[i].count;
+  }
+  pp_shared->hot_count = nhot;
+  pp_shared->hot_generation = generation;
+  pg_write_barrier();
+  pg_atomic_fetch_add_u64(&pp_shared->hot_seq, 1);
+
+  /*
+   * Age the counts. Increments racing with this are lost, which the
+   * estimate tolerates.
+   */
+  for (i = 0; i < PP_CMS_DEPTH; i++) {
+    for (j = 0; j < PP_CMS_WIDTH; j++) {
+      pg_atomic_uint32 *counter = &pp_shared->cms[i][j];
+
+      pg_atomic_write_u32(counter, pg_atomic_read_u32(counter) >> 1);
+    }
+  }
+
+  /* a candidate must beat the coldest hot word, after aging */
+  threshold = nhot > 0 && nhot == passHotTierSize
+                  ? words[nhot - 1].count >> 1
+                  : 0;
+  pg_atomic_write_u32(&pp_shared->hot_threshold,
+                      Max(threshold, PP_HOT_MIN_COUNT));
+
+  pfree(words);
+}
+
+/* a word of the dump, hashed so the file does not contain it */
+typedef struct PPHotDumped {
+  uint64 hash;
+  uint32 count;
+} PPHotDumped;
+
+/* the words of the dump found in the index while restoring */
+typedef struct PPHotRestore {
+  PPHotDumped *dumped;
+  int ndumped;
+  int restored;
+} PPHotRestore;
+
+/*
+ * seeded with the system identifier so that only the cluster writing a dump
+ * and its standbys restore it; this is not a secret
+ */
+static uint64 dump_hash(const char *word) {
+  return hash_bytes_extended((const unsigned char *)word, strlen(word),
+                             GetSystemIdentifier());
+}
+
+static int dumped_cmp(const void *a, const void *b) {
+  uint64 ha = ((const PPHotDumped *)a)->hash;
+  uint64 hb = ((const PPHotDumped *)b)->hash;
+
+  return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+/*
+ * pp_hot_dump
+ *
+ * writes the hashes and counts of the words in the tier to the dump file,
+ * replacing it atomically; called by the worker. The file gets the mode of
+ * the other files of the data directory, readable by its owner only unless
+ * the cluster allows group access.
+ */
+void pp_hot_dump(void) {
+  FILE *file;
+  int i;
+
+  file = AllocateFile(PP_HOT_DUMP_TMP_FILE, PG_BINARY_W);
+  if (file == NULL) {
+    ereport(LOG, (errcode_for_file_access(),
+                  errmsg("could not open file \"%s\": %m.",
+                         PP_HOT_DUMP_TMP_FILE)));
+    return;
+  }
+
+  /* the worker is the only writer of the tier, read it as is */
+  fprintf(file, "%s\n", PP_HOT_DUMP_MAGIC);
+  for (i = 0; i < pp_shared->hot_count; i++) {
+    fprintf(file, "%016" INT64_MODIFIER "x %u\n",
+            dump_hash(pp_shared->hot[i].word), pp_shared->hot[i].count);
+  }
+
+  if (ferror(file) || FreeFile(file) != 0) {
+    ereport(LOG, (errcode_for_file_access(),
+                  errmsg("could not write file \"%s\": %m.",
+                         PP_HOT_DUMP_TMP_FILE)));
+    unlink(PP_HOT_DUMP_TMP_FILE);
+    return;
+  }
+  (void)durable_rename(PP_HOT_DUMP_TMP_FILE, PP_HOT_DUMP_FILE, LOG);
+}
+
+static void restore_word(const char *word, uint32 lists, void *arg) {
+  PPHotRestore *restore = (PPHotRestore *)arg;
+  PPHotDumped key;
+  PPHotDumped *dumped;
+
+  key.hash = dump_hash(word);
+  dumped = bsearch(&key, restore->dumped, restore->ndumped,
+                   sizeof(PPHotDumped), dumped_cmp);
+  if (dumped == NULL) {
+    return;
+  }
+
+  cms_add_n(word, dumped->count);
+  SpinLockAcquire(&pp_shared->candidate_lock);
+  if (pp_shared->ncandidates < PP_HOT_CANDIDATES) {
+    strlcpy(pp_shared->candidates[pp_shared->ncandidates++], word,
+            PP_MAX_PATTERN_LEN + 1);
+  }
+  SpinLockRelease(&pp_shared->candidate_lock);
+  restore->restored++;
+}
+
+/*
+ * pp_hot_restore
+ *
+ * rebuilds the tier from the dump file, if there is one; called by the
+ * worker once the denylists are loaded
+ */
+void pp_hot_restore(void) {
+  PPHotDumped dumped[PP_HOT_TIER_SIZE];
+  PPHotRestore restore;
+  char line[128];
+  FILE *file;
+
+  file = AllocateFile(PP_HOT_DUMP_FILE, PG_BINARY_R);
+  if (file == NULL) {
+    if (errno != ENOENT) {
+      ereport(LOG, (errcode_for_file_access(),
+                    errmsg("could not open file \"%s\": %m.",
+                           PP_HOT_DUMP_FILE)));
+    }
+    return;
+  }
+
+  restore.dumped = dumped;
+  restore.ndumped = 0;
+  restore.restored = 0;
+  if (fgets(line, sizeof(line), file) == NULL ||
+      strncmp(line, PP_HOT_DUMP_MAGIC, strlen(PP_HOT_DUMP_MAGIC)) != 0) {
+    ereport(LOG, (errmsg("ignoring invalid file \"%s\".", PP_HOT_DUMP_FILE)));
+    FreeFile(file);
+    return;
+  }
+  while (restore.ndumped < PP_HOT_TIER_SIZE &&
+         fgets(line, sizeof(line), file) != NULL) {
+    PPHotDumped *d = &dumped[restore.ndumped];
+
+    if (sscanf(line, "%" INT64_MODIFIER "x %u", &d->hash, &d->count) == 2) {
+      restore.ndumped++;
+    }
+  }
+  FreeFile(file);
+
+  if (restore.ndumped == 0) {
+    return;
+  }
+
+  qsort(dumped, restore.ndumped, sizeof(PPHotDumped), dumped_cmp);
+  pp_denylist_foreach(restore_word, &restore);
+  pp_hot_promote();
+
+  elog(LOG, "passwordpolicy restored %d of %d hot tier words.",
+       restore.restored, restore.ndumped);
+}
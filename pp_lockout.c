@@ -0,0 +1,251 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_lockout.c
+ *
+ * Lockout of roles after failed logins.
+ *
+ * Every failed login is counted for the role and for the role connecting
+ * from that address. Once either count reaches p_policy.max_failed_logins
+ * within p_policy.lockout_duration, logins of the role (from that address)
+ * are rejected for p_policy.lockout_duration, even with the right
+ * password. A successful login clears the counts.
+ *
+ * The counters live in a fixed hash table in the main shared memory
+ * segment that is only updated with atomic operations, so a burst of
+ * failed logins never queues backends on a lock. Keys are 64 bit hashes of
+ * the role and address; a slot that is neither locked nor failed recently
+ * may be taken over by another key, racing updates of the old key are
+ * lost, which only makes the lockout more lenient.
+ *
+ * ClientAuthentication_hook runs once the authentication exchange is over,
+ * so a locked role still costs the server a SCRAM exchange; what the
+ * lockout stops is the guessing. Logins of locked roles fail with the same
+ * message as a wrong password, not to tell the guesser it found it.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "common/hashfn.h"
+#include "fmgr.h"
+#include "libpq/auth.h"
+#include "libpq/hba.h"
+#include "libpq/libpq-be.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+#include "passwordpolicy.h"
+
+static ClientAuthentication_hook_type prev_client_auth_hook = NULL;
+
+PG_FUNCTION_INFO_V1(passwordpolicy_unlock);
+
+static uint64 lockout_key(const char *role, const char *address) {
+  uint64 key =
+      hash_bytes_extended((const unsigned char *)role, strlen(role), 0);
+
+  if (address != NULL) {
+    key = hash_combine64(key, hash_bytes_extended((const unsigned char *)address,
+                                                  strlen(address), 1));
+  }
+  /* 0 marks a free slot */
+  return key != 0 ? key : 1;
+}
+
+/* whether a slot's lockout and failures are over */
+static bool slot_stale(PPLockoutSlot *slot, TimestampTz now) {
+  TimestampTz window = (TimestampTz)passLockoutDuration * USECS_PER_SEC;
+
+  return (TimestampTz)pg_atomic_read_u64(&slot->locked_until) <= now &&
+         (TimestampTz)pg_atomic_read_u64(&slot->last_failure) + window <= now;
+}
+
+/*
+ * finds the slot of key, claiming a free or stale one for it when insert
+ * is set; returns NULL if there is none
+ */
+static PPLockoutSlot *lockout_slot(uint64 key, bool insert, TimestampTz now) {
+  uint32 start = (uint32)(key % PP_LOCKOUT_SLOTS);
+  int i;
+
+  for (i = 0; i < PP_LOCKOUT_PROBES; i++) {
+    PPLockoutSlot *slot = &pp_shared->lockout[(start + i) % PP_LOCKOUT_SLOTS];
+    uint64 current = pg_atomic_read_u64(&slot->key);
+
+    if (current == key) {
+      return slot;
+    }
+    if (current != 0) {
+      continue;
+    }
+    if (!insert) {
+      return NULL;
+    }
+    if (pg_atomic_compare_exchange_u64(&slot->key, &current, key) ||
+        current == key) {
+      return slot;
+    }
+  }
+
+  if (!insert) {
+    return NULL;
+  }
+
+  for (i = 0; i < PP_LOCKOUT_PROBES; i++) {
+    PPLockoutSlot *slot = &pp_shared->lockout[(start + i) % PP_LOCKOUT_SLOTS];
+    uint64 current = pg_atomic_read_u64(&slot->key);
+
+    if (slot_stale(slot, now) &&
+        pg_atomic_compare_exchange_u64(&slot->key, &current, key)) {
+      pg_atomic_write_u32(&slot->failures, 0);
+      pg_atomic_write_u64(&slot->locked_until, 0);
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+static void record_failure(PPLockoutSlot *slot, const char *role,
+                           const char *address, TimestampTz now) {
+  TimestampTz window = (TimestampTz)passLockoutDuration * USECS_PER_SEC;
+  TimestampTz last;
+
+  if ((TimestampTz)pg_atomic_read_u64(&slot->locked_until) > now) {
+    return;
+  }
+
+  /* failures older than the window don't count */
+  last = (TimestampTz)pg_atomic_exchange_u64(&slot->last_failure, (uint64)now);
+  if (last + window <= now) {
+    pg_atomic_write_u32(&slot->failures, 0);
+  }
+
+  if (pg_atomic_add_fetch_u32(&slot->failures, 1) <
+      (uint32)passMaxFailedLogins) {
+    return;
+  }
+
+  pg_atomic_write_u64(&slot->locked_until, (uint64)(now + window));
+  pg_atomic_write_u32(&slot->failures, 0);
+  if (address != NULL) {
+    ereport(LOG, (errmsg("passwordpolicy locked role \"%s\" from %s after %d "
+                         "failed logins.",
+                         role, address, passMaxFailedLogins)));
+  } else {
+    ereport(LOG, (errmsg("passwordpolicy locked role \"%s\" after %d failed "
+                         "logins.",
+                         role, passMaxFailedLogins)));
+  }
+}
+
+static void reject_locked(Port *port, TimestampTz until) {
+  UserAuth method = port->hba->auth_method;
+
+  pp_count(PP_COUNTER_LOCKED_LOGINS);
+
+  if (method == uaPassword || method == uaMD5 || method == uaSCRAM) {
+    ereport(FATAL, (errcode(ERRCODE_INVALID_PASSWORD),
+                    errmsg("password authentication failed for user \"%s\"",
+                           port->user_name),
+                    errdetail_log("Role is locked by passwordpolicy until %s.",
+                                  timestamptz_to_str(until))));
+  }
+  ereport(FATAL, (errcode(ERRCODE_INVALID_AUTHORIZATION_SPECIFICATION),
+                  errmsg("authentication failed for user \"%s\"",
+                         port->user_name),
+                  errdetail_log("Role is locked by passwordpolicy until %s.",
+                                timestamptz_to_str(until))));
+}
+
+static void pp_client_auth(Port *port, int status) {
+  const char *addresses[2];
+  PPLockoutSlot *slots[2];
+  TimestampTz now;
+  int i;
+
+  if (prev_client_auth_hook) {
+    prev_client_auth_hook(port, status);
+  }
+
+  /* STATUS_EOF is a client that hung up, such as psql asking for a password */
+  if (pp_shared == NULL || passMaxFailedLogins <= 0 ||
+      port->user_name == NULL || status == STATUS_EOF) {
+    return;
+  }
+
+  now = GetCurrentTimestamp();
+  addresses[0] = NULL;
+  addresses[1] = port->remote_host;
+  for (i = 0; i < 2; i++) {
+    slots[i] = lockout_slot(lockout_key(port->user_name, addresses[i]),
+                            status == STATUS_ERROR, now);
+  }
+
+  if (status == STATUS_ERROR) {
+    /* the server reports the failure itself */
+    for (i = 0; i < 2; i++) {
+      if (slots[i] != NULL) {
+        record_failure(slots[i], port->user_name, addresses[i], now);
+      }
+    }
+    return;
+  }
+
+  for (i = 0; i < 2; i++) {
+    TimestampTz until;
+
+    if (slots[i] == NULL) {
+      continue;
+    }
+    until = (TimestampTz)pg_atomic_read_u64(&slots[i]->locked_until);
+    if (until > now) {
+      reject_locked(port, until);
+    }
+  }
+  for (i = 0; i < 2; i++) {
+    if (slots[i] != NULL) {
+      pg_atomic_write_u32(&slots[i]->failures, 0);
+    }
+  }
+}
+
+/*
+ * pp_lockout_init
+ *
+ * installs the authentication hook, called from _PG_init while
+ * shared_preload_libraries is processed
+ */
+void pp_lockout_init(void) {
+  prev_client_auth_hook = ClientAuthentication_hook;
+  ClientAuthentication_hook = pp_client_auth;
+}
+
+/*
+ * passwordpolicy_unlock
+ *
+ * lifts the lockout of a role, or of a role from an address, and clears
+ * its failed logins; returns false if it had none
+ */
+Datum passwordpolicy_unlock(PG_FUNCTION_ARGS) {
+  char *role;
+  char *address = NULL;
+  PPLockoutSlot *slot;
+
+  pp_require_shared();
+  if (PG_ARGISNULL(0)) {
+    PG_RETURN_BOOL(false);
+  }
+  role = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  if (!PG_ARGISNULL(1)) {
+    address = text_to_cstring(PG_GETARG_TEXT_PP(1));
+  }
+
+  slot = lockout_slot(lockout_key(role, address), false, GetCurrentTimestamp());
+  if (slot == NULL) {
+    PG_RETURN_BOOL(false);
+  }
+  pg_atomic_write_u64(&slot->locked_until, 0);
+  pg_atomic_write_u32(&slot->failures, 0);
+  PG_RETURN_BOOL(true);
+}
@@ -0,0 +1,197 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_memory.c
+ *
+ * Memory accounting of passwordpolicy.
+ *
+ * Everything a backend keeps across checks is allocated in children of the
+ * "passwordpolicy" memory context, so it shows up in
+ * pg_backend_memory_contexts. p_policy.backend_memory_limit caps them: a
+ * backend whose contexts grow past it drops its denylist mapping after the
+ * check and maps it again on the next one.
+ *
+ * passwordpolicy_memory reports the structures in shared memory, how much
+ * of them is resident and how many entries they hold against their limits.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "passwordpolicy.h"
+
+/* parent of the per-backend contexts, created on first use */
+static MemoryContext backend_context = NULL;
+
+PG_FUNCTION_INFO_V1(passwordpolicy_memory);
+
+/*
+ * pp_backend_context
+ *
+ * returns the "passwordpolicy" memory context the per-backend structures
+ * are allocated under
+ */
+MemoryContext pp_backend_context(void) {
+  if (backend_context == NULL) {
+    backend_context = AllocSetContextCreate(TopMemoryContext, "passwordpolicy",
+                                            ALLOCSET_SMALL_SIZES);
+  }
+  return backend_context;
+}
+
+/*
+ * pp_memory_enforce
+ *
+ * drops the per-backend structures when they take more than
+ * p_policy.backend_memory_limit, called after every check
+ */
+void pp_memory_enforce(void) {
+  Size allocated;
+
+  if (passBackendMemoryLimit <= 0 || backend_context == NULL) {
+    return;
+  }
+
+  allocated = MemoryContextMemAllocated(backend_context, true);
+  if (allocated <= (Size)passBackendMemoryLimit * 1024) {
+    return;
+  }
+
+  elog(DEBUG1, "passwordpolicy evicts %zu bytes of backend memory.",
+       allocated);
+  pp_denylist_detach();
+}
+
+/* bytes of [addr, addr + size) resident in memory, -1 if unknown */
+static int64 resident_bytes(const void *addr, Size size) {
+#ifndef WIN32
+  long pagesize = sysconf(_SC_PAGESIZE);
+  uintptr_t start;
+  uintptr_t end;
+  Size npages;
+  unsigned char *vec;
+  int64 resident = 0;
+  Size i;
+
+  if (pagesize <= 0 || size == 0) {
+    return -1;
+  }
+
+  start = (uintptr_t)addr & ~((uintptr_t)pagesize - 1);
+  end = ((uintptr_t)addr + size + pagesize - 1) & ~((uintptr_t)pagesize - 1);
+  npages = (end - start) / pagesize;
+
+  vec = (unsigned char *)palloc(npages);
+  if (mincore((void *)start, end - start, (void *)vec) != 0) {
+    pfree(vec);
+    return -1;
+  }
+  for (i = 0; i < npages; i++) {
+    if (vec[i] & 1) {
+      resident += pagesize;
+    }
+  }
+  pfree(vec);
+  return resident;
+#else
+  return -1;
+#endif
+}
+
+/* one row of passwordpolicy_memory, negative values are NULL */
+static void put_row(ReturnSetInfo *rsinfo, const char *structure,
+                    const char *kind, int64 size, int64 size_limit,
+                    int64 resident, int64 entries, int64 entries_limit,
+                    int64 generation) {
+  Datum values[8];
+  bool nulls[8] = {false, false, false, false, false, false, false, false};
+  int64 numbers[6];
+  int i;
+
+  numbers[0] = size;
+  numbers[1] = size_limit;
+  numbers[2] = resident;
+  numbers[3] = entries;
+  numbers[4] = entries_limit;
+  numbers[5] = generation;
+
+  values[0] = CStringGetTextDatum(structure);
+  values[1] = CStringGetTextDatum(kind);
+  for (i = 0; i < 6; i++) {
+    if (numbers[i] < 0) {
+      nulls[i + 2] = true;
+    } else {
+      values[i + 2] = Int64GetDatum(numbers[i]);
+    }
+  }
+  tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+}
+
+/*
+ * passwordpolicy_memory
+ *
+ * returns one row per structure with its size, the part of it resident in
+ * memory, its entries and the limits of both; the generation of the
+ * denylist structures tells whether they changed between two calls
+ */
+Datum passwordpolicy_memory(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  PPSharedState *s;
+  uint64 queued;
+  int64 trie_size;
+  int64 trie_nodes;
+  uint64 trie_generation;
+
+  pp_require_shared();
+  InitMaterializedSRF(fcinfo, 0);
+  s = pp_shared;
+
+  put_row(rsinfo, "shared state", "shared", (int64)pp_shmem_size(), -1,
+          resident_bytes(s, pp_shmem_size()), -1, -1, -1);
+
+  SpinLockAcquire(&s->queue_lock);
+  queued = s->queue_head - s->queue_tail;
+  SpinLockRelease(&s->queue_lock);
+  put_row(rsinfo, "shadow queue", "shared", (int64)sizeof(s->queue), -1,
+          resident_bytes(s->queue, sizeof(s->queue)), (int64)queued,
+          PP_SHADOW_QUEUE_SIZE, -1);
+
+  put_row(rsinfo, "hot tier", "shared", (int64)sizeof(s->hot), -1,
+          resident_bytes(s->hot, sizeof(s->hot)), s->hot_count,
+          passHotTierSize, (int64)s->hot_generation);
+
+  put_row(rsinfo, "hot tier sketch", "shared", (int64)sizeof(s->cms), -1,
+          resident_bytes(s->cms, sizeof(s->cms)), -1, -1, -1);
+
+  /* the segments of the area are not exposed, only estimate them */
+  put_row(rsinfo, "denylist index", "dynamic shared",
+          (int64)pp_denylist_size(), -1, -1,
+          pg_atomic_read_u32(&s->denylist_entries),
+          passDenylistMaxWords > 0 ? passDenylistMaxWords : -1,
+          (int64)pg_atomic_read_u64(&s->denylist_generation));
+
+  if (pp_fuzzy_size(&trie_size, &trie_nodes, &trie_generation)) {
+    put_row(rsinfo, "fuzzy trie", "dynamic shared", trie_size, -1, -1,
+            trie_nodes, -1, (int64)trie_generation);
+  }
+
+  put_row(rsinfo, "backend", "backend",
+          backend_context != NULL
+              ? (int64)MemoryContextMemAllocated(backend_context, true)
+              : 0,
+          passBackendMemoryLimit > 0 ? (int64)passBackendMemoryLimit * 1024
+                                     : -1,
+          -1, -1, -1, -1);
+
+  return (Datum)0;
+}
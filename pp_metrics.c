@@ -0,0 +1,459 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_metrics.c
+ *
+ * OpenMetrics exporter of passwordpolicy.
+ *
+ * An optional background worker serves the counters and histograms from
+ * shared memory over plain HTTP on a local TCP port or UNIX socket, so
+ * scraping them needs no database connection.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include "passwordpolicy.h"
+
+/*
+ * milliseconds a scraper gets to send its request and read the answer;
+ * scrapes are served one at a time, a slow one delays the others
+ */
+#define PP_METRICS_IO_TIMEOUT_MS 1000L
+
+/* milliseconds to wait after accept failed for lack of resources */
+#define PP_METRICS_ACCEPT_BACKOFF_MS 1000L
+
+static pgsocket listen_sock = PGINVALID_SOCKET;
+
+/*
+ * pp_register_metrics_worker
+ *
+ * registers the exporter, called from _PG_init while
+ * shared_preload_libraries is processed
+ */
+void pp_register_metrics_worker(void) {
+  BackgroundWorker worker;
+
+  memset(&worker, 0, sizeof(worker));
+  worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+  worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+  worker.bgw_restart_time = 10;
+  snprintf(worker.bgw_library_name, BGW_MAXLEN, "passwordpolicy");
+  snprintf(worker.bgw_function_name, BGW_MAXLEN,
+           "passwordpolicy_metrics_main");
+  snprintf(worker.bgw_name, BGW_MAXLEN, "passwordpolicy metrics");
+  snprintf(worker.bgw_type, BGW_MAXLEN, "passwordpolicy metrics");
+  RegisterBackgroundWorker(&worker);
+}
+
+static void render_counters(StringInfo buf) {
+  int i;
+
+  for (i = 0; i < PP_NUM_COUNTERS; i++) {
+    const char *name = pp_counter_name((PPCounter)i);
+
+    appendStringInfo(buf,
+                     "# TYPE passwordpolicy_%s counter\n"
+                     "# HELP passwordpolicy_%s %s\n",
+                     name, name, pp_counter_help((PPCounter)i));
+    appendStringInfo(buf, "passwordpolicy_%s_total " UINT64_FORMAT "\n", name,
+                     pg_atomic_read_u64(&pp_shared->counters[i]));
+  }
+}
+
+static void render_verdicts(StringInfo buf, const char *name, const char *help,
+                            pg_atomic_uint64 *verdicts) {
+  int i;
+
+  appendStringInfo(buf, "# TYPE %s counter\n# HELP %s %s\n", name, name, help);
+  for (i = 0; i < PP_NUM_RULES; i++) {
+    appendStringInfo(buf, "%s_total{rule=\"%s\"} " UINT64_FORMAT "\n", name,
+                     pp_rule_name((PPRule)i),
+                     pg_atomic_read_u64(&verdicts[i]));
+  }
+}
+
+static void render_stages(StringInfo buf) {
+  const char *name = "passwordpolicy_stage_seconds";
+  int i, j;
+
+  appendStringInfo(buf,
+                   "# TYPE %s histogram\n"
+                   "# HELP %s Time spent in each stage of check_password.\n",
+                   name, name);
+  for (i = 0; i < PP_NUM_STAGES; i++) {
+    PPLatency *latency = &pp_shared->stages[i];
+    const char *stage = pp_stage_name((PPStage)i);
+    uint64 cumulative = 0;
+
+    for (j = 0; j < PP_LATENCY_BUCKETS; j++) {
+      cumulative += pg_atomic_read_u64(&latency->buckets[j]);
+      if (j < PP_LATENCY_BUCKETS - 1) {
+        appendStringInfo(buf, "%s_bucket{stage=\"%s\",le=\"%g\"} " UINT64_FORMAT
+                              "\n",
+                         name, stage, pp_latency_bounds_us[j] / 1000000.0,
+                         cumulative);
+      } else {
+        appendStringInfo(buf,
+                         "%s_bucket{stage=\"%s\",le=\"+Inf\"} " UINT64_FORMAT
+                         "\n",
+                         name, stage, cumulative);
+      }
+    }
+    appendStringInfo(buf, "%s_sum{stage=\"%s\"} %.6f\n", name, stage,
+                     pg_atomic_read_u64(&latency->sum_us) / 1000000.0);
+    appendStringInfo(buf, "%s_count{stage=\"%s\"} " UINT64_FORMAT "\n", name,
+                     stage, pg_atomic_read_u64(&latency->count));
+  }
+}
+
+/*
+ * append_label_value
+ *
+ * appends a label value escaped as the OpenMetrics text format asks
+ */
+static void append_label_value(StringInfo buf, const char *value) {
+  const char *c;
+
+  for (c = value; *c != '\0'; c++) {
+    if (*c == '\\') {
+      appendStringInfoString(buf, "\\\\");
+    } else if (*c == '"') {
+      appendStringInfoString(buf, "\\\"");
+    } else if (*c == '\n') {
+      appendStringInfoString(buf, "\\n");
+    } else {
+      appendStringInfoChar(buf, *c);
+    }
+  }
+}
+
+static void render_lists(StringInfo buf) {
+  int i;
+
+  appendStringInfoString(buf,
+                         "# TYPE passwordpolicy_denylist_hits counter\n"
+                         "# HELP passwordpolicy_denylist_hits Passwords "
+                         "containing a word of the denylist.\n");
+  LWLockAcquire(pp_shared->lock, LW_SHARED);
+  for (i = 0; i < PP_MAX_LISTS; i++) {
+    PPList *list = &pp_shared->lists[i];
+
+    if (list->used) {
+      appendStringInfoString(buf, "passwordpolicy_denylist_hits_total{list=\"");
+      append_label_value(buf, list->name);
+      appendStringInfo(buf, "\",action=\"%s\"} " UINT64_FORMAT "\n",
+                       list->action == PP_LIST_WARN ? "warn" : "reject",
+                       pg_atomic_read_u64(&list->hits));
+    }
+  }
+  LWLockRelease(pp_shared->lock);
+}
+
+/* renders every metric in the OpenMetrics text format */
+static void render_metrics(StringInfo buf) {
+  render_verdicts(buf, "passwordpolicy_verdicts",
+                  "Passwords judged by the enforced policy, by rule.",
+                  pp_shared->verdicts);
+  render_verdicts(buf, "passwordpolicy_shadow_verdicts",
+                  "Passwords judged by the shadow policy, by rule.",
+                  pp_shared->shadow_verdicts);
+  render_counters(buf);
+  render_stages(buf);
+  render_lists(buf);
+
+  appendStringInfoString(buf,
+                         "# TYPE passwordpolicy_shared_memory_bytes gauge\n"
+                         "# HELP passwordpolicy_shared_memory_bytes Size of "
+                         "the main shared memory state.\n");
+  appendStringInfo(buf, "passwordpolicy_shared_memory_bytes %zu\n",
+                   (size_t)pp_shmem_size());
+
+  appendStringInfoString(buf,
+                         "# TYPE passwordpolicy_denylist_entries gauge\n"
+                         "# HELP passwordpolicy_denylist_entries Words in the "
+                         "denylist.\n");
+  appendStringInfo(buf, "passwordpolicy_denylist_entries %u\n",
+                   pg_atomic_read_u32(&pp_shared->denylist_entries));
+  appendStringInfoString(buf,
+                         "# TYPE passwordpolicy_denylist_generation gauge\n"
+                         "# HELP passwordpolicy_denylist_generation Changes "
+                         "made to the denylist since startup.\n");
+  appendStringInfo(buf, "passwordpolicy_denylist_generation " UINT64_FORMAT
+                        "\n",
+                   pg_atomic_read_u64(&pp_shared->denylist_generation));
+
+  appendStringInfoString(buf,
+                         "# TYPE passwordpolicy_hot_tier_words gauge\n"
+                         "# HELP passwordpolicy_hot_tier_words Denylist words "
+                         "in the hot tier.\n");
+  appendStringInfo(buf, "passwordpolicy_hot_tier_words %d\n",
+                   pp_shared->hot_count);
+
+  appendStringInfoString(buf, "# EOF\n");
+}
+
+static pgsocket listen_tcp(void) {
+  struct sockaddr_in addr;
+  pgsocket sock;
+  int one = 1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16)passMetricsPort);
+  if (inet_pton(AF_INET, passMetricsListenAddress, &addr.sin_addr) != 1) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("invalid p_policy.metrics_listen_address \"%s\".",
+                           passMetricsListenAddress)));
+  }
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock == PGINVALID_SOCKET) {
+    ereport(ERROR, (errcode_for_socket_access(),
+                    errmsg("could not create metrics socket: %m")));
+  }
+  (void)setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    ereport(ERROR, (errcode_for_socket_access(),
+                    errmsg("could not bind metrics port %d: %m",
+                           passMetricsPort)));
+  }
+  return sock;
+}
+
+static pgsocket listen_unix(void) {
+  struct sockaddr_un addr;
+  pgsocket sock;
+
+  if (strlen(passMetricsSocket) >= sizeof(addr.sun_path)) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("p_policy.metrics_socket is too long.")));
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strlcpy(addr.sun_path, passMetricsSocket, sizeof(addr.sun_path));
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == PGINVALID_SOCKET) {
+    ereport(ERROR, (errcode_for_socket_access(),
+                    errmsg("could not create metrics socket: %m")));
+  }
+  (void)unlink(passMetricsSocket);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    ereport(ERROR, (errcode_for_socket_access(),
+                    errmsg("could not bind metrics socket \"%s\": %m",
+                           passMetricsSocket)));
+  }
+  return sock;
+}
+
+static void close_listen_sock(int code, Datum arg) {
+  if (listen_sock != PGINVALID_SOCKET) {
+    closesocket(listen_sock);
+    listen_sock = PGINVALID_SOCKET;
+  }
+  if (passMetricsPort == 0 && passMetricsSocket[0] != '\0') {
+    (void)unlink(passMetricsSocket);
+  }
+}
+
+/*
+ * wait_client
+ *
+ * waits until the client socket is ready for the given event, false once
+ * the deadline of the scrape has passed
+ */
+static bool wait_client(pgsocket client, int event, TimestampTz deadline) {
+  long timeout;
+  int rc;
+
+  timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+  if (timeout <= 0) {
+    return false;
+  }
+  rc = WaitLatchOrSocket(MyLatch, WL_LATCH_SET | event | WL_TIMEOUT |
+                                      WL_EXIT_ON_PM_DEATH,
+                         client, timeout, PG_WAIT_EXTENSION);
+  if (rc & WL_LATCH_SET) {
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+  }
+  return true;
+}
+
+static bool send_all(pgsocket client, const char *data, size_t len,
+                     TimestampTz deadline) {
+  while (len > 0) {
+    ssize_t n = send(client, data, len, 0);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      if (!wait_client(client, WL_SOCKET_WRITEABLE, deadline)) {
+        return false;
+      }
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/*
+ * read_request
+ *
+ * reads the request up to the end of its headers, or as much of it as
+ * fits the buffer
+ */
+static bool read_request(pgsocket client, TimestampTz deadline) {
+  char request[1024];
+  int len = 0;
+
+  while (len < (int)sizeof(request) - 1) {
+    ssize_t n = recv(client, request + len, sizeof(request) - 1 - len, 0);
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      if (!wait_client(client, WL_SOCKET_READABLE, deadline)) {
+        return false;
+      }
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    len += n;
+    request[len] = '\0';
+    if (strstr(request, "\r\n\r\n") != NULL ||
+        strstr(request, "\n\n") != NULL) {
+      return true;
+    }
+  }
+  return true;
+}
+
+/*
+ * answers one scrape; whatever was asked for, the reply is the full
+ * metrics page
+ */
+static void serve_client(pgsocket client, StringInfo body) {
+  TimestampTz deadline;
+  char header[256];
+  int header_len;
+
+  deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+                                         PP_METRICS_IO_TIMEOUT_MS);
+  if (!read_request(client, deadline)) {
+    return;
+  }
+
+  render_metrics(body);
+  header_len = snprintf(header, sizeof(header),
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: application/openmetrics-text; "
+                        "version=1.0.0; charset=utf-8\r\n"
+                        "Content-Length: %d\r\n"
+                        "Connection: close\r\n\r\n",
+                        body->len);
+  if (send_all(client, header, header_len, deadline)) {
+    (void)send_all(client, body->data, body->len, deadline);
+  }
+}
+
+void passwordpolicy_metrics_main(Datum main_arg) {
+  MemoryContext scrape_context;
+  StringInfoData body;
+
+  pqsignal(SIGHUP, SignalHandlerForConfigReload);
+  pqsignal(SIGTERM, die);
+  BackgroundWorkerUnblockSignals();
+
+  scrape_context = AllocSetContextCreate(TopMemoryContext,
+                                         "passwordpolicy metrics",
+                                         ALLOCSET_DEFAULT_SIZES);
+
+  on_shmem_exit(close_listen_sock, (Datum)0);
+  listen_sock = passMetricsPort > 0 ? listen_tcp() : listen_unix();
+  if (listen(listen_sock, 16) < 0) {
+    ereport(ERROR, (errcode_for_socket_access(),
+                    errmsg("could not listen for metrics scrapes: %m")));
+  }
+  if (!pg_set_noblock(listen_sock)) {
+    ereport(ERROR, (errcode_for_socket_access(),
+                    errmsg("could not set metrics socket to nonblocking "
+                           "mode: %m")));
+  }
+
+  for (;;) {
+    pgsocket client;
+    int accept_errno;
+
+    (void)WaitLatchOrSocket(MyLatch,
+                            WL_LATCH_SET | WL_SOCKET_READABLE |
+                                WL_EXIT_ON_PM_DEATH,
+                            listen_sock, -1L, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+
+    if (ConfigReloadPending) {
+      ConfigReloadPending = false;
+      ProcessConfigFile(PGC_SIGHUP);
+    }
+
+    while ((client = accept(listen_sock, NULL, NULL)) != PGINVALID_SOCKET) {
+      MemoryContext oldcontext;
+
+      if (!pg_set_noblock(client)) {
+        closesocket(client);
+        continue;
+      }
+
+      oldcontext = MemoryContextSwitchTo(scrape_context);
+      initStringInfo(&body);
+      serve_client(client, &body);
+      closesocket(client);
+
+      MemoryContextSwitchTo(oldcontext);
+      MemoryContextReset(scrape_context);
+      CHECK_FOR_INTERRUPTS();
+    }
+    accept_errno = errno;
+
+    /*
+     * Out of descriptors and the like leave the socket readable, wait
+     * before accepting again instead of spinning.
+     */
+    if (accept_errno != EAGAIN && accept_errno != EWOULDBLOCK &&
+        accept_errno != EINTR && accept_errno != ECONNABORTED) {
+      errno = accept_errno;
+      ereport(LOG, (errcode_for_socket_access(),
+                    errmsg("could not accept metrics scrape: %m")));
+      (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                      PP_METRICS_ACCEPT_BACKOFF_MS, PG_WAIT_EXTENSION);
+      ResetLatch(MyLatch);
+    }
+  }
+}
@@ -0,0 +1,96 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_saslprep.c
+ *
+ * SASLprep normalization of passwords before they are checked.
+ *
+ * SCRAM hashes the SASLprep'd form of a password, so that is the password
+ * users actually get. Checking the raw bytes instead lets full-width and
+ * other compatibility forms slip past the dictionaries, and makes
+ * equivalent inputs classify differently.
+ *
+ * Normalizing is expensive compared to the rest of the checks, and it
+ * rarely changes anything: pure ASCII strings are left alone by SASLprep,
+ * and strings the NFKC quick check accepts are only changed by the
+ * mappings of RFC 3454, so only the remaining strings go through
+ * pg_saslprep.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "common/saslprep.h"
+#include "common/string.h"
+#include "common/unicode_norm.h"
+#include "mb/pg_wchar.h"
+
+#include "passwordpolicy.h"
+
+/*
+ * whether SASLprep maps the character to nothing (RFC 3454 table B.1) or
+ * to a space (table C.1.2), which the NFKC quick check does not see
+ */
+static bool saslprep_maps(pg_wchar c) {
+  return c == 0x00A0 || c == 0x00AD || c == 0x034F || c == 0x1680 ||
+         c == 0x1806 || (c >= 0x180B && c <= 0x180D) ||
+         (c >= 0x2000 && c <= 0x200D) || c == 0x202F || c == 0x205F ||
+         c == 0x2060 || c == 0x3000 || (c >= 0xFE00 && c <= 0xFE0F) ||
+         c == 0xFEFF;
+}
+
+/* whether pg_saslprep could change str, which is not pure ASCII */
+static bool needs_saslprep(const char *str) {
+  const unsigned char *p = (const unsigned char *)str;
+  const unsigned char *end = p + strlen(str);
+  pg_wchar *chars;
+  bool maps = false;
+  bool needed;
+  int n = 0;
+
+  chars = (pg_wchar *)palloc(sizeof(pg_wchar) * (end - p + 1));
+  while (p < end) {
+    int len = pg_utf_mblen(p);
+
+    /* SCRAM uses invalid UTF-8 as it is */
+    if (len > end - p || !pg_utf8_islegal(p, len)) {
+      pfree(chars);
+      return false;
+    }
+    chars[n] = utf8_to_unicode(p);
+    maps |= saslprep_maps(chars[n]);
+    n++;
+    p += len;
+  }
+  chars[n] = 0;
+
+  needed = maps || unicode_is_normalized_quickcheck(UNICODE_NFKC, chars) !=
+                       UNICODE_NORM_QC_YES;
+  pfree(chars);
+  return needed;
+}
+
+/*
+ * pp_saslprep
+ *
+ * returns the SASLprep'd form of str, or str itself if SASLprep leaves it
+ * alone or SCRAM would use it as it is
+ */
+const char *pp_saslprep(const char *str) {
+  char *prepped;
+
+  /* the common case */
+  if (pg_is_ascii(str)) {
+    return str;
+  }
+
+  if (!needs_saslprep(str) ||
+      pg_saslprep(str, &prepped) != SASLPREP_SUCCESS) {
+    return str;
+  }
+  if (strcmp(prepped, str) == 0) {
+    pfree(prepped);
+    return str;
+  }
+  return prepped;
+}
@@ -0,0 +1,246 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_shmem.c
+ *
+ * Shared memory state and statistics of passwordpolicy.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+
+#include "passwordpolicy.h"
+
+PPSharedState *pp_shared = NULL;
+
+/* upper bounds of the latency histogram buckets, in microseconds */
+const uint64 pp_latency_bounds_us[PP_LATENCY_BUCKETS - 1] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000};
+
+static const char *const stage_names[PP_NUM_STAGES] = {
+    "saslprep", "policy", "denylist", "fuzzy", "cracklib"};
+
+static const struct {
+  const char *name;
+  const char *help;
+} counter_info[PP_NUM_COUNTERS] = {
+    {"shadow_dropped",
+     "Passwords not judged by the shadow policy because its queue was full."},
+    {"fast_path",
+     "Random secrets accepted without the dictionary stages."},
+    {"hot_tier",
+     "Passwords rejected by the denylist hot tier without probing the "
+     "index."},
+    {"saslprep", "Passwords SASLprep changed before they were checked."},
+    {"locked_logins",
+     "Logins rejected because the role was locked after failed logins."},
+};
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+PG_FUNCTION_INFO_V1(passwordpolicy_stats);
+PG_FUNCTION_INFO_V1(passwordpolicy_counters);
+
+Size pp_shmem_size(void) { return MAXALIGN(sizeof(PPSharedState)); }
+
+static void pp_shmem_request(void) {
+  if (prev_shmem_request_hook) {
+    prev_shmem_request_hook();
+  }
+  RequestAddinShmemSpace(add_size(pp_shmem_size(), pp_age_shmem_size()));
+  RequestNamedLWLockTranche("passwordpolicy", 3);
+}
+
+static void pp_shmem_startup(void) {
+  bool found;
+  int i, j;
+
+  if (prev_shmem_startup_hook) {
+    prev_shmem_startup_hook();
+  }
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+  pp_shared = ShmemInitStruct("passwordpolicy", pp_shmem_size(), &found);
+  if (!found) {
+    memset(pp_shared, 0, sizeof(PPSharedState));
+    for (i = 0; i < PP_NUM_RULES; i++) {
+      pg_atomic_init_u64(&pp_shared->verdicts[i], 0);
+      pg_atomic_init_u64(&pp_shared->shadow_verdicts[i], 0);
+    }
+    for (i = 0; i < PP_NUM_COUNTERS; i++) {
+      pg_atomic_init_u64(&pp_shared->counters[i], 0);
+    }
+    for (i = 0; i < PP_NUM_STAGES; i++) {
+      for (j = 0; j < PP_LATENCY_BUCKETS; j++) {
+        pg_atomic_init_u64(&pp_shared->stages[i].buckets[j], 0);
+      }
+      pg_atomic_init_u64(&pp_shared->stages[i].count, 0);
+      pg_atomic_init_u64(&pp_shared->stages[i].sum_us, 0);
+    }
+    SpinLockInit(&pp_shared->queue_lock);
+
+    pp_shared->lock = &(GetNamedLWLockTranche("passwordpolicy"))[0].lock;
+    pp_shared->age_lock = &(GetNamedLWLockTranche("passwordpolicy"))[1].lock;
+    pp_shared->trie_lock = &(GetNamedLWLockTranche("passwordpolicy"))[2].lock;
+    pp_shared->dsa_tranche_id = LWLockNewTrancheId();
+    pp_shared->denylist_area = DSA_HANDLE_INVALID;
+    pp_shared->denylist_hash = InvalidDsaPointer;
+    pp_shared->trie = InvalidDsaPointer;
+    pp_shared->staged_head = InvalidDsaPointer;
+    pp_shared->staged_tail = InvalidDsaPointer;
+    pg_atomic_init_u32(&pp_shared->denylist_entries, 0);
+    pg_atomic_init_u64(&pp_shared->denylist_generation, 0);
+    pg_atomic_init_u32(&pp_shared->reject_lists, 0);
+    for (i = 0; i < PP_MAX_LISTS; i++) {
+      pg_atomic_init_u64(&pp_shared->lists[i].hits, 0);
+    }
+
+    for (i = 0; i < PP_CMS_DEPTH; i++) {
+      for (j = 0; j < PP_CMS_WIDTH; j++) {
+        pg_atomic_init_u32(&pp_shared->cms[i][j], 0);
+      }
+    }
+    pg_atomic_init_u32(&pp_shared->hot_threshold, 2);
+    pg_atomic_init_u64(&pp_shared->hot_seq, 0);
+    SpinLockInit(&pp_shared->candidate_lock);
+
+    for (i = 0; i < PP_LOCKOUT_SLOTS; i++) {
+      PPLockoutSlot *slot = &pp_shared->lockout[i];
+
+      pg_atomic_init_u64(&slot->key, 0);
+      pg_atomic_init_u32(&slot->failures, 0);
+      pg_atomic_init_u64(&slot->last_failure, 0);
+      pg_atomic_init_u64(&slot->locked_until, 0);
+    }
+  }
+  pp_age_shmem_startup();
+  LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * pp_shmem_init
+ *
+ * installs the shared memory hooks, called from _PG_init while
+ * shared_preload_libraries is processed
+ */
+void pp_shmem_init(void) {
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook = pp_shmem_request;
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook = pp_shmem_startup;
+}
+
+/* count the verdict of the enforced policy */
+void pp_count_verdict(PPRule rule) {
+  if (pp_shared != NULL) {
+    pg_atomic_fetch_add_u64(&pp_shared->verdicts[rule], 1);
+  }
+}
+
+/* count an event */
+void pp_count(PPCounter counter) {
+  if (pp_shared != NULL) {
+    pg_atomic_fetch_add_u64(&pp_shared->counters[counter], 1);
+  }
+}
+
+const char *pp_counter_name(PPCounter counter) {
+  return counter_info[counter].name;
+}
+
+const char *pp_counter_help(PPCounter counter) {
+  return counter_info[counter].help;
+}
+
+/* account the time a stage of check_password took */
+void pp_observe_stage(PPStage stage, uint64 us) {
+  PPLatency *latency;
+  int bucket = 0;
+
+  if (pp_shared == NULL) {
+    return;
+  }
+
+  while (bucket < PP_LATENCY_BUCKETS - 1 &&
+         us > pp_latency_bounds_us[bucket]) {
+    bucket++;
+  }
+
+  latency = &pp_shared->stages[stage];
+  pg_atomic_fetch_add_u64(&latency->buckets[bucket], 1);
+  pg_atomic_fetch_add_u64(&latency->count, 1);
+  pg_atomic_fetch_add_u64(&latency->sum_us, us);
+}
+
+const char *pp_stage_name(PPStage stage) { return stage_names[stage]; }
+
+void pp_require_shared(void) {
+  if (pp_shared == NULL) {
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("passwordpolicy must be loaded via "
+                    "shared_preload_libraries.")));
+  }
+}
+
+/*
+ * passwordpolicy_stats
+ *
+ * returns one row per rule with the number of passwords the enforced and
+ * the shadow policy judged with it; the "ok" row counts accepted passwords
+ */
+Datum passwordpolicy_stats(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  int i;
+
+  pp_require_shared();
+  InitMaterializedSRF(fcinfo, 0);
+
+  for (i = 0; i < PP_NUM_RULES; i++) {
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+
+    values[0] = CStringGetTextDatum(pp_rule_name((PPRule)i));
+    values[1] = Int64GetDatum(
+        (int64)pg_atomic_read_u64(&pp_shared->verdicts[i]));
+    values[2] = Int64GetDatum(
+        (int64)pg_atomic_read_u64(&pp_shared->shadow_verdicts[i]));
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
+
+/*
+ * passwordpolicy_counters
+ *
+ * returns the event counters
+ */
+Datum passwordpolicy_counters(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  int i;
+
+  pp_require_shared();
+  InitMaterializedSRF(fcinfo, 0);
+
+  for (i = 0; i < PP_NUM_COUNTERS; i++) {
+    Datum values[2];
+    bool nulls[2] = {false, false};
+
+    values[0] = CStringGetTextDatum(pp_counter_name((PPCounter)i));
+    values[1] = Int64GetDatum(
+        (int64)pg_atomic_read_u64(&pp_shared->counters[i]));
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
@@ -0,0 +1,574 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_validate.c
+ *
+ * Standalone password validation library used by passwordpolicy.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include <math.h>
+#include <string.h>
+
+#include "pp_confusables.h"
+#include "pp_validate.h"
+
+/*
+ * A uniformly random secret draws from at least the 62 letters and
+ * digits, so it repeats few characters: it has at least this share of the
+ * distinct characters expected from such a draw. Generated secrets are at
+ * least PP_SECRET_MIN_LENGTH characters long; about four in five random
+ * letters and digits, and nearly all secrets with special characters, have
+ * the bits per character and the class changes below.
+ */
+#define PP_SECRET_ALPHABET 62
+#define PP_SECRET_DISTINCT_SHARE 0.9
+#define PP_SECRET_MIN_LENGTH 40
+#define PP_SECRET_MIN_BITS_PER_CHAR 4.0
+#define PP_SECRET_TRANSITION_SHARE 0.55
+
+/* character classes, indexed by byte */
+#define PP_CLASS_SPECIAL 0
+#define PP_CLASS_NUMBER 1
+#define PP_CLASS_UPPER 2
+#define PP_CLASS_LOWER 3
+
+static const char *const rule_names[PP_NUM_RULES] = {
+    "ok",      "length",   "username",    "forbidden", "numbers",
+    "special", "upper",    "lower",       "distinct",  "transitions",
+    "repeat",  "denylist", "cracklib",
+};
+
+/*
+ * isalpha() does not work for multibyte encodings and depends on the
+ * locale, so classify bytes ourselves and consider non-ASCII bytes special
+ * characters.
+ */
+static inline int char_class(unsigned char c) {
+  if (c >= '0' && c <= '9') {
+    return PP_CLASS_NUMBER;
+  } else if (c >= 'A' && c <= 'Z') {
+    return PP_CLASS_UPPER;
+  } else if (c >= 'a' && c <= 'z') {
+    return PP_CLASS_LOWER;
+  }
+  return PP_CLASS_SPECIAL;
+}
+
+static inline int popcount64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static inline char fold_char(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/* the ASCII character a code point looks like, 0 if there is none */
+static char confusable(uint32_t cp) {
+  size_t lo = 0;
+  size_t hi = PP_NUM_CONFUSABLES;
+
+  /* full-width forms of ! to ~ */
+  if (cp >= 0xFF01 && cp <= 0xFF5E) {
+    return (char)(cp - 0xFF01 + '!');
+  }
+
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+
+    if (pp_confusables[mid].codepoint == cp) {
+      return pp_confusables[mid].prototype;
+    } else if (pp_confusables[mid].codepoint < cp) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Feed a byte that is not plain ASCII, or that follows an incomplete
+ * sequence, to the skeleton decoder. Writes the bytes of the skeleton that
+ * became known to out and returns how many there are; broken sequences
+ * come out as they came in.
+ */
+static int skeleton_step(PPSkeleton *sk, unsigned char b, char *out) {
+  int n = 0;
+  int i;
+
+  if ((b & 0xC0) == 0x80 && sk->need > 0) {
+    sk->pending[sk->npending++] = b;
+    sk->codepoint = (sk->codepoint << 6) | (b & 0x3F);
+    if (--sk->need == 0) {
+      char c = confusable(sk->codepoint);
+
+      if (c != 0) {
+        out[n++] = c;
+      } else {
+        for (i = 0; i < sk->npending; i++) {
+          out[n++] = (char)sk->pending[i];
+        }
+      }
+      sk->npending = 0;
+    }
+    return n;
+  }
+
+  /* whatever was pending is not a character */
+  for (i = 0; i < sk->npending; i++) {
+    out[n++] = (char)sk->pending[i];
+  }
+  sk->npending = 0;
+  sk->need = 0;
+
+  if (b >= 0xC2 && b <= 0xDF) {
+    sk->need = 1;
+    sk->codepoint = b & 0x1F;
+  } else if (b >= 0xE0 && b <= 0xEF) {
+    sk->need = 2;
+    sk->codepoint = b & 0x0F;
+  } else if (b >= 0xF0 && b <= 0xF4) {
+    sk->need = 3;
+    sk->codepoint = b & 0x07;
+  } else {
+    out[n++] = (char)b;
+    return n;
+  }
+  sk->pending[sk->npending++] = b;
+  return n;
+}
+
+/*
+ * pp_skeleton
+ *
+ * writes the skeleton of str to out, which holds outlen bytes, and returns
+ * its length; the skeleton is never longer than str
+ */
+size_t pp_skeleton(const char *str, char *out, size_t outlen) {
+  PPSkeleton sk;
+  char buf[5];
+  size_t len = 0;
+  int i, n;
+
+  if (outlen == 0) {
+    return 0;
+  }
+
+  memset(&sk, 0, sizeof(sk));
+  for (; *str != '\0'; str++) {
+    unsigned char b = (unsigned char)*str;
+
+    if (b < 0x80 && sk.need == 0) {
+      buf[0] = *str;
+      n = 1;
+    } else {
+      n = skeleton_step(&sk, b, buf);
+    }
+    for (i = 0; i < n && len + 1 < outlen; i++) {
+      out[len++] = buf[i];
+    }
+  }
+  /* an incomplete sequence at the end stays as it is */
+  for (i = 0; i < sk.npending && len + 1 < outlen; i++) {
+    out[len++] = (char)sk.pending[i];
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static int16_t scanner_new_node(PPScanner *s, char c) {
+  PPScanNode *node = &s->nodes[s->nnodes];
+
+  node->child = -1;
+  node->sibling = -1;
+  node->fail = 0;
+  node->c = c;
+  node->out = 0;
+  return (int16_t)s->nnodes++;
+}
+
+/* the child of node for c, -1 if there is none */
+static inline int scanner_child(const PPScanner *s, int node, char c) {
+  int child;
+
+  for (child = s->nodes[node].child; child >= 0;
+       child = s->nodes[child].sibling) {
+    if (s->nodes[child].c == c) {
+      return child;
+    }
+  }
+  return -1;
+}
+
+/* the state after state reads the folded character c */
+static inline int scanner_next(const PPScanner *s, int state, char c) {
+  while (state != 0) {
+    int child = scanner_child(s, state, c);
+
+    if (child >= 0) {
+      return child;
+    }
+    state = s->nodes[state].fail;
+  }
+  return s->root[(unsigned char)c];
+}
+
+/*
+ * Add the skeleton of a pattern to the trie of the scanner. Patterns that
+ * are empty or longer than PP_MAX_PATTERN_LEN never match.
+ */
+static void scanner_add(PPScanner *s, const char *pattern, PPRule rule,
+                        bool exact) {
+  char skeleton[PP_MAX_PATTERN_LEN + 1];
+  size_t len = pattern ? strlen(pattern) : 0;
+  PPScanPattern *p;
+  int node = 0;
+  int i;
+
+  if (len == 0 || len > PP_MAX_PATTERN_LEN ||
+      s->npatterns == PP_SCAN_MAX_PATTERNS) {
+    return;
+  }
+
+  p = &s->patterns[s->npatterns];
+  p->len = (int)pp_skeleton(pattern, skeleton, sizeof(skeleton));
+  if (p->len == 0) {
+    return;
+  }
+  memcpy(p->text, skeleton, p->len);
+  p->rule = rule;
+  p->exact = exact;
+
+  for (i = 0; i < p->len; i++) {
+    char c = fold_char(p->text[i]);
+    int child = scanner_child(s, node, c);
+
+    if (child < 0) {
+      child = scanner_new_node(s, c);
+      s->nodes[child].sibling = s->nodes[node].child;
+      s->nodes[node].child = (int16_t)child;
+    }
+    node = child;
+  }
+  s->nodes[node].out |= UINT32_C(1) << s->npatterns;
+  if (exact) {
+    s->exact |= UINT32_C(1) << s->npatterns;
+  }
+  s->npatterns++;
+}
+
+/*
+ * Compute the failure links breadth first, so the links of shallower
+ * nodes are known when a node needs them, and merge the patterns of each
+ * node's suffixes into its own.
+ */
+static void scanner_link(PPScanner *s) {
+  int16_t queue[PP_SCAN_MAX_NODES];
+  int head = 0;
+  int tail = 0;
+  int child;
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    s->root[i] = 0;
+  }
+  for (child = s->nodes[0].child; child >= 0;
+       child = s->nodes[child].sibling) {
+    s->root[(unsigned char)s->nodes[child].c] = (int16_t)child;
+    s->nodes[child].fail = 0;
+    queue[tail++] = (int16_t)child;
+  }
+
+  while (head < tail) {
+    int node = queue[head++];
+
+    for (child = s->nodes[node].child; child >= 0;
+         child = s->nodes[child].sibling) {
+      int fail = scanner_next(s, s->nodes[node].fail, s->nodes[child].c);
+
+      s->nodes[child].fail = (int16_t)fail;
+      s->nodes[child].out |= s->nodes[fail].out;
+      queue[tail++] = (int16_t)child;
+    }
+  }
+}
+
+/*
+ * pp_scanner_init
+ *
+ * compiles the user name (exact match) and the forbidden substrings
+ * (ASCII case insensitive) into one automaton; build it again when they
+ * change
+ */
+void pp_scanner_init(PPScanner *s, const char *username,
+                     const char *const *forbidden, int nforbidden) {
+  int i;
+
+  s->npatterns = 0;
+  s->exact = 0;
+  s->nnodes = 0;
+  (void)scanner_new_node(s, '\0');
+
+  scanner_add(s, username, PP_RULE_USERNAME, true);
+  if (nforbidden > PP_MAX_FORBIDDEN) {
+    nforbidden = PP_MAX_FORBIDDEN;
+  }
+  for (i = 0; i < nforbidden; i++) {
+    scanner_add(s, forbidden[i], PP_RULE_FORBIDDEN, false);
+  }
+  scanner_link(s);
+}
+
+/*
+ * pp_stream_init
+ *
+ * policy: thresholds to judge the password by
+ * username: role name the password must not contain (exact match)
+ * forbidden: substrings the password must not contain (ASCII case
+ *			insensitive)
+ *
+ * The strings are copied, the caller may free them afterwards.
+ */
+void pp_stream_init(PPStream *stream, const PPPolicy *policy,
+                    const char *username, const char *const *forbidden,
+                    int nforbidden) {
+  stream->policy = *policy;
+  pp_scanner_init(&stream->scanner, username, forbidden, nforbidden);
+  pp_stream_reset(stream);
+}
+
+/* forget the characters seen so far, keeping policy and patterns */
+void pp_stream_reset(PPStream *stream) {
+  memset(&stream->features, 0, sizeof(stream->features));
+  memset(stream->seen, 0, sizeof(stream->seen));
+  memset(stream->histogram, 0, sizeof(stream->histogram));
+  stream->last_class = -1;
+  memset(&stream->skeleton, 0, sizeof(stream->skeleton));
+  stream->state = 0;
+  stream->fed = 0;
+  memset(stream->recent, 0, sizeof(stream->recent));
+  stream->hits = 0;
+}
+
+/* whether the last characters fed are exactly the text of pattern */
+static bool exact_hit(const PPStream *stream, const PPScanPattern *p) {
+  uint32_t start = stream->fed - (uint32_t)p->len;
+  int i;
+
+  for (i = 0; i < p->len; i++) {
+    if (stream->recent[(start + i) % PP_MAX_PATTERN_LEN] != p->text[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* record the patterns that end at the last character */
+static void report_hits(PPStream *stream, uint32_t out) {
+  const PPScanner *s = &stream->scanner;
+  int i;
+
+  for (i = 0; i < s->npatterns; i++) {
+    if ((out & (UINT32_C(1) << i)) == 0) {
+      continue;
+    }
+    if ((s->exact & (UINT32_C(1) << i)) != 0 &&
+        !exact_hit(stream, &s->patterns[i])) {
+      continue;
+    }
+
+    stream->hits |= UINT32_C(1) << i;
+    switch (s->patterns[i].rule) {
+    case PP_RULE_USERNAME:
+      stream->features.username_hit = true;
+      break;
+    case PP_RULE_FORBIDDEN:
+      stream->features.forbidden_hit = true;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+/* feed a character of the skeleton to the scanner */
+static inline void match_char(PPStream *stream, char c) {
+  uint32_t out;
+
+  stream->recent[stream->fed++ % PP_MAX_PATTERN_LEN] = c;
+  stream->state = scanner_next(&stream->scanner, stream->state, fold_char(c));
+  out = stream->scanner.nodes[stream->state].out & ~stream->hits;
+  if (out != 0) {
+    report_hits(stream, out);
+  }
+}
+
+void pp_stream_append(PPStream *stream, const char *chars, size_t len) {
+  PPFeatures *f = &stream->features;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    char c = chars[i];
+    unsigned char b = (unsigned char)c;
+    int cls = char_class(b);
+    uint32_t repeat;
+
+    /* diversity: seen bitmap, histogram and class changes */
+    stream->seen[b >> 6] |= UINT64_C(1) << (b & 63);
+    repeat = ++stream->histogram[b];
+    if ((int)repeat > f->max_repeat) {
+      f->max_repeat = (int)repeat;
+    }
+    if (stream->last_class >= 0 && cls != stream->last_class) {
+      f->transitions++;
+    }
+    stream->last_class = cls;
+
+    switch (cls) {
+    case PP_CLASS_NUMBER:
+      f->numbers++;
+      break;
+    case PP_CLASS_UPPER:
+      f->upper++;
+      break;
+    case PP_CLASS_LOWER:
+      f->lower++;
+      break;
+    default:
+      f->special++;
+      break;
+    }
+
+    /* plain ASCII is its own skeleton */
+    if (b < 0x80 && stream->skeleton.need == 0) {
+      match_char(stream, c);
+    } else {
+      char skeleton[5];
+      int n = skeleton_step(&stream->skeleton, b, skeleton);
+      int j;
+
+      for (j = 0; j < n; j++) {
+        match_char(stream, skeleton[j]);
+      }
+    }
+  }
+  f->length += (int)len;
+}
+
+PPRule pp_stream_verdict(PPStream *stream) {
+  stream->features.distinct =
+      popcount64(stream->seen[0]) + popcount64(stream->seen[1]) +
+      popcount64(stream->seen[2]) + popcount64(stream->seen[3]);
+  return pp_evaluate(&stream->policy, &stream->features);
+}
+
+/*
+ * pp_stream_entropy
+ *
+ * computes the empirical entropy in bits of the characters seen so far,
+ * n * log2(n) - sum(c * log2(c)) over the byte histogram, and stores it in
+ * the features
+ */
+double pp_stream_entropy(PPStream *stream) {
+  double n = stream->features.length;
+  double bits = 0.0;
+  int i;
+
+  if (stream->features.length > 1) {
+    bits = n * log2(n);
+    for (i = 0; i < 256; i++) {
+      if (stream->histogram[i] > 1) {
+        bits -= stream->histogram[i] * log2((double)stream->histogram[i]);
+      }
+    }
+  }
+  stream->features.entropy_bits = bits;
+  return bits;
+}
+
+/*
+ * pp_is_random_secret
+ *
+ * decides whether the features are those of a uniformly random secret
+ * with at least min_entropy_bits of entropy. Secret managers generate 40
+ * to 64 characters, and a random draw of that length from letters and
+ * digits has close to log2(62) bits per character, uses three character
+ * classes, changes class on most characters and repeats characters no
+ * more often than expected. A passphrase of the same length gets about as
+ * many bits in total, but fails the per character entropy, the class
+ * changes or the repeats: its words are runs of lower case letters.
+ */
+bool pp_is_random_secret(const PPFeatures *features, double min_entropy_bits) {
+  int classes;
+  double expected;
+
+  if (min_entropy_bits <= 0.0 || features->length < PP_SECRET_MIN_LENGTH ||
+      features->entropy_bits < min_entropy_bits ||
+      features->entropy_bits <
+          PP_SECRET_MIN_BITS_PER_CHAR * features->length) {
+    return false;
+  }
+
+  classes = (features->numbers > 0) + (features->special > 0) +
+            (features->upper > 0) + (features->lower > 0);
+  if (classes < 3) {
+    return false;
+  }
+
+  if (features->transitions <
+      PP_SECRET_TRANSITION_SHARE * (features->length - 1)) {
+    return false;
+  }
+
+  expected = PP_SECRET_ALPHABET *
+             (1.0 - pow(1.0 - 1.0 / PP_SECRET_ALPHABET, features->length));
+  return features->distinct >= PP_SECRET_DISTINCT_SHARE * expected;
+}
+
+/*
+ * pp_evaluate
+ *
+ * returns the first rule the features violate, or PP_RULE_OK
+ */
+PPRule pp_evaluate(const PPPolicy *policy, const PPFeatures *features) {
+  if (features->length < policy->min_length) {
+    return PP_RULE_LENGTH;
+  } else if (features->username_hit) {
+    return PP_RULE_USERNAME;
+  } else if (features->forbidden_hit) {
+    return PP_RULE_FORBIDDEN;
+  } else if (features->numbers < policy->min_numbers) {
+    return PP_RULE_NUMBERS;
+  } else if (features->special < policy->min_special) {
+    return PP_RULE_SPECIAL;
+  } else if (features->upper < policy->min_upper) {
+    return PP_RULE_UPPER;
+  } else if (features->lower < policy->min_lower) {
+    return PP_RULE_LOWER;
+  } else if (features->distinct < policy->min_distinct) {
+    return PP_RULE_DISTINCT;
+  } else if (features->transitions < policy->min_transitions) {
+    return PP_RULE_TRANSITIONS;
+  } else if (policy->max_repeat_share > 0.0 &&
+             features->max_repeat >
+                 policy->max_repeat_share * features->length) {
+    return PP_RULE_REPEAT;
+  }
+  return PP_RULE_OK;
+}
+
+const char *pp_rule_name(PPRule rule) {
+  if (rule < 0 || rule >= PP_NUM_RULES) {
+    return "unknown";
+  }
+  return rule_names[rule];
+}
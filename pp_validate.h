@@ -0,0 +1,177 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_validate.h
+ *
+ * Standalone password validation library used by passwordpolicy.
+ *
+ * Nothing in here depends on the backend: the same rules can be compiled
+ * into a client-side service to give users the server's verdict while
+ * they type.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PP_VALIDATE_H
+#define PP_VALIDATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* longest username or forbidden substring the matchers accept */
+#define PP_MAX_PATTERN_LEN 64
+
+/* maximum number of forbidden substrings in a policy */
+#define PP_MAX_FORBIDDEN 16
+
+/*
+ * Rules, in the order they are reported. PP_RULE_OK means no rule
+ * rejected the password.
+ */
+typedef enum PPRule {
+  PP_RULE_OK = 0,
+  PP_RULE_LENGTH,
+  PP_RULE_USERNAME,
+  PP_RULE_FORBIDDEN,
+  PP_RULE_NUMBERS,
+  PP_RULE_SPECIAL,
+  PP_RULE_UPPER,
+  PP_RULE_LOWER,
+  PP_RULE_DISTINCT,
+  PP_RULE_TRANSITIONS,
+  PP_RULE_REPEAT,
+  PP_RULE_DENYLIST,
+  PP_RULE_CRACKLIB,
+  PP_NUM_RULES
+} PPRule;
+
+typedef struct PPPolicy {
+  int min_length;
+  int min_special;
+  int min_numbers;
+  int min_upper;
+  int min_lower;
+  int min_distinct;
+  int min_transitions;
+  /* largest share of the length one character may take, 0 allows any */
+  double max_repeat_share;
+} PPPolicy;
+
+/*
+ * Everything the rules need to know about a password. It never contains
+ * the password itself, so it can be handed to other processes.
+ */
+typedef struct PPFeatures {
+  int length;
+  int numbers;
+  int special;
+  int upper;
+  int lower;
+  bool username_hit;
+  bool forbidden_hit;
+  /* number of different bytes */
+  int distinct;
+  /* adjacent characters of different classes */
+  int transitions;
+  /* occurrences of the most frequent byte */
+  int max_repeat;
+  /* empirical Shannon entropy of the bytes, see pp_stream_entropy */
+  double entropy_bits;
+  /* looks like a machine generated secret, see pp_is_random_secret */
+  bool random_secret;
+} PPFeatures;
+
+/*
+ * UTF-8 decoder mapping characters to their skeleton: confusable
+ * characters become the ASCII character they look like, everything else
+ * stays as it is.
+ */
+typedef struct PPSkeleton {
+  uint32_t codepoint;
+  int need;
+  int npending;
+  unsigned char pending[4];
+} PPSkeleton;
+
+/* patterns a scanner holds: the user name and the forbidden substrings */
+#define PP_SCAN_MAX_PATTERNS (1 + PP_MAX_FORBIDDEN)
+#define PP_SCAN_MAX_NODES (1 + PP_SCAN_MAX_PATTERNS * PP_MAX_PATTERN_LEN)
+
+/* a substring the scanner looks for, and the rule it belongs to */
+typedef struct PPScanPattern {
+  PPRule rule;
+  /* matched case sensitively */
+  bool exact;
+  int len;
+  char text[PP_MAX_PATTERN_LEN];
+} PPScanPattern;
+
+/* node of the automaton, node 0 is the root */
+typedef struct PPScanNode {
+  int16_t child;   /* first child, -1 if none */
+  int16_t sibling; /* next child of the parent, -1 if none */
+  int16_t fail;    /* longest proper suffix that is a node */
+  char c;
+  /* bitmask of the patterns ending here or at a suffix of the node */
+  uint32_t out;
+} PPScanNode;
+
+/*
+ * Aho-Corasick automaton over the case folded skeletons of all patterns,
+ * so one pass finds every pattern whatever the number of patterns. Exact
+ * patterns are checked against the last characters seen when they match.
+ */
+typedef struct PPScanner {
+  int npatterns;
+  PPScanPattern patterns[PP_SCAN_MAX_PATTERNS];
+  uint32_t exact;
+  int nnodes;
+  PPScanNode nodes[PP_SCAN_MAX_NODES];
+  /* transitions of the root, where most characters end up */
+  int16_t root[256];
+} PPScanner;
+
+/*
+ * Incremental validator. Appending a character updates the features and
+ * the scanner state in O(1) amortized time, so the verdict is always
+ * available without rescanning the password. The scanner runs over the
+ * skeletons of the password and the patterns, so look-alike letters don't
+ * get around the user name and forbidden substring rules.
+ */
+typedef struct PPStream {
+  PPPolicy policy;
+  PPFeatures features;
+  uint64_t seen[4];
+  uint32_t histogram[256];
+  int last_class;
+  PPSkeleton skeleton;
+  PPScanner scanner;
+  int state;
+  /* skeleton characters fed so far, the last ones kept in recent */
+  uint32_t fed;
+  char recent[PP_MAX_PATTERN_LEN];
+  /* bitmask of the patterns found, see scanner.patterns */
+  uint32_t hits;
+} PPStream;
+
+extern void pp_scanner_init(PPScanner *s, const char *username,
+                            const char *const *forbidden, int nforbidden);
+
+extern void pp_stream_init(PPStream *stream, const PPPolicy *policy,
+                           const char *username, const char *const *forbidden,
+                           int nforbidden);
+extern void pp_stream_reset(PPStream *stream);
+extern void pp_stream_append(PPStream *stream, const char *chars, size_t len);
+extern PPRule pp_stream_verdict(PPStream *stream);
+extern double pp_stream_entropy(PPStream *stream);
+
+extern size_t pp_skeleton(const char *str, char *out, size_t outlen);
+
+extern bool pp_is_random_secret(const PPFeatures *features,
+                                double min_entropy_bits);
+
+extern PPRule pp_evaluate(const PPPolicy *policy, const PPFeatures *features);
+extern const char *pp_rule_name(PPRule rule);
+
+#endif /* PP_VALIDATE_H */
@@ -0,0 +1,213 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_wal.c
+ *
+ * WAL resource manager of passwordpolicy.
+ *
+ * The denylist index and the password changes live in shared memory and
+ * are only backed by tables, so a standby would have to read the tables
+ * again after its promotion. With p_policy.wal_log_changes set, every
+ * transaction changing them also writes a record of the changes before it
+ * commits.
+ *
+ * A record is replayed before the commit record of its transaction, which
+ * may never come: the transaction can still fail, or the primary crash.
+ * Replaying one therefore only stages it, keyed by the transaction ID, in
+ * the dynamic shared memory area of the denylist index. The worker applies
+ * the staged records in the order they were logged once their transaction
+ * committed, drops them once it aborted, and stops at the first one whose
+ * transaction is still in progress. The worker of a standby loads the
+ * tables once the standby is consistent; staged records of transactions
+ * its snapshot sees are in the tables already and are skipped. So its
+ * structures are warm and current when it is promoted.
+ *
+ * Every server replaying the WAL must load passwordpolicy via
+ * shared_preload_libraries. A standby without hot_standby keeps the staged
+ * records until it is promoted, since its worker only starts then.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "access/transam.h"
+#include "access/xlog_internal.h"
+#include "access/xloginsert.h"
+#include "access/xlogreader.h"
+#include "lib/stringinfo.h"
+#include "storage/procarray.h"
+#include "utils/snapmgr.h"
+
+#include "passwordpolicy.h"
+
+/*
+ * ID of the resource manager; RM_EXPERIMENTAL_ID until one is reserved for
+ * passwordpolicy
+ */
+#define PP_RMGR_ID RM_EXPERIMENTAL_ID
+
+/* a replayed record waiting for the end of its transaction */
+typedef struct PPStagedRecord {
+  dsa_pointer next;
+  TransactionId xid;
+  uint8 info;
+  /* the tables the worker loaded have the changes already */
+  bool skip;
+  Size len;
+  char data[FLEXIBLE_ARRAY_MEMBER];
+} PPStagedRecord;
+
+/* stages the record, see pp_wal_apply */
+static void pp_redo(XLogReaderState *record) {
+  uint8 info = XLogRecGetInfo(record) & ~XLR_INFO_MASK;
+  Size len = XLogRecGetDataLen(record);
+  dsa_area *area;
+  dsa_pointer p;
+  PPStagedRecord *staged;
+
+  if (info != XLOG_PP_DENYLIST && info != XLOG_PP_PASSWORD_CHANGES) {
+    elog(PANIC, "passwordpolicy redo: unknown op code %u.", info);
+  }
+
+  area = pp_denylist_area(true);
+  p = dsa_allocate(area, offsetof(PPStagedRecord, data) + len);
+  staged = (PPStagedRecord *)dsa_get_address(area, p);
+  staged->next = InvalidDsaPointer;
+  staged->xid = XLogRecGetXid(record);
+  staged->info = info;
+  staged->skip = false;
+  staged->len = len;
+  memcpy(staged->data, XLogRecGetData(record), len);
+
+  LWLockAcquire(pp_shared->lock, LW_EXCLUSIVE);
+  if (DsaPointerIsValid(pp_shared->staged_tail)) {
+    ((PPStagedRecord *)dsa_get_address(area, pp_shared->staged_tail))->next =
+        p;
+  } else {
+    pp_shared->staged_head = p;
+  }
+  pp_shared->staged_tail = p;
+  LWLockRelease(pp_shared->lock);
+
+  pp_wake_worker();
+}
+
+static void pp_desc(StringInfo buf, XLogReaderState *record) {
+  appendStringInfo(buf, "%u bytes of changes", XLogRecGetDataLen(record));
+}
+
+static const char *pp_identify(uint8 info) {
+  switch (info & ~XLR_INFO_MASK) {
+  case XLOG_PP_DENYLIST:
+    return "DENYLIST";
+  case XLOG_PP_PASSWORD_CHANGES:
+    return "PASSWORD_CHANGES";
+  default:
+    return NULL;
+  }
+}
+
+static const RmgrData pp_rmgr = {
+    .rm_name = "passwordpolicy",
+    .rm_redo = pp_redo,
+    .rm_desc = pp_desc,
+    .rm_identify = pp_identify,
+};
+
+/*
+ * pp_wal_init
+ *
+ * registers the resource manager, called from _PG_init while
+ * shared_preload_libraries is processed
+ */
+void pp_wal_init(void) {
+  RegisterCustomRmgr(PP_RMGR_ID, &pp_rmgr);
+}
+
+/*
+ * pp_wal_log
+ *
+ * writes a record of changes to WAL if p_policy.wal_log_changes is set;
+ * the commit record of the transaction flushes it
+ */
+void pp_wal_log(uint8 info, char *data, Size len) {
+  if (!passWalLogChanges) {
+    return;
+  }
+
+  XLogBeginInsert();
+  XLogRegisterData(data, (uint32)len);
+  (void)XLogInsert(PP_RMGR_ID, info);
+}
+
+/*
+ * pp_wal_skip_visible
+ *
+ * marks the staged denylist records of transactions the snapshot sees as
+ * committed, the denylist tables read with it have their changes; called
+ * by the worker while it loads the tables, with pp_shared->lock held
+ * exclusively
+ */
+void pp_wal_skip_visible(dsa_area *area, Snapshot snapshot) {
+  dsa_pointer p;
+
+  for (p = pp_shared->staged_head; DsaPointerIsValid(p);) {
+    PPStagedRecord *staged = (PPStagedRecord *)dsa_get_address(area, p);
+
+    if (staged->info == XLOG_PP_DENYLIST &&
+        !XidInMVCCSnapshot(staged->xid, snapshot) &&
+        TransactionIdDidCommit(staged->xid)) {
+      staged->skip = true;
+    }
+    p = staged->next;
+  }
+}
+
+/*
+ * pp_wal_apply
+ *
+ * applies the staged records of committed transactions in the order they
+ * were logged and drops those of aborted ones, stopping at the first
+ * transaction still in progress; called by the worker after it loaded the
+ * tables
+ */
+void pp_wal_apply(void) {
+  dsa_area *area = pp_denylist_area(false);
+
+  if (area == NULL) {
+    return;
+  }
+
+  for (;;) {
+    PPStagedRecord *staged;
+    dsa_pointer p;
+
+    /* the startup process appends, only the worker removes */
+    LWLockAcquire(pp_shared->lock, LW_SHARED);
+    p = pp_shared->staged_head;
+    LWLockRelease(pp_shared->lock);
+    if (!DsaPointerIsValid(p)) {
+      break;
+    }
+
+    staged = (PPStagedRecord *)dsa_get_address(area, p);
+    if (TransactionIdIsInProgress(staged->xid)) {
+      break;
+    }
+    if (!staged->skip && TransactionIdDidCommit(staged->xid)) {
+      if (staged->info == XLOG_PP_DENYLIST) {
+        pp_denylist_redo(staged->data, staged->len);
+      } else {
+        pp_age_redo(staged->data, staged->len);
+      }
+    }
+
+    LWLockAcquire(pp_shared->lock, LW_EXCLUSIVE);
+    pp_shared->staged_head = staged->next;
+    if (!DsaPointerIsValid(staged->next)) {
+      pp_shared->staged_tail = InvalidDsaPointer;
+    }
+    LWLockRelease(pp_shared->lock);
+    dsa_free(area, p);
+  }
+}
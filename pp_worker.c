@@ -0,0 +1,238 @@
+/*-------------------------------------------------------------------------
+ *
+ * pp_worker.c
+ *
+ * Background worker of passwordpolicy.
+ *
+ * The worker evaluates the shadow policy. Backends only push the
+ * features of accepted passwords onto a queue in shared memory, so trying
+ * out a stricter policy adds next to nothing to CREATE/ALTER ROLE.
+ *
+ * It is connected to p_policy.database and loads the denylists from there
+ * after startup, or once the extension is created there, and it promotes
+ * frequently matched words into their hot tier, which it dumps to disk and
+ * restores across restarts, and builds the trie of the words for fuzzy
+ * matching, see pp_fuzzy.c. It also
+ * writes password changes through to their table, see pp_age.c, and
+ * looks for expiring roles, see pp_expiry.c.
+ *
+ * Copyright (c) 2018, indrajit
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+
+#include "passwordpolicy.h"
+
+/* how many queued features the worker evaluates per lock acquisition */
+#define PP_SHADOW_BATCH 64
+
+/*
+ * pp_register_worker
+ *
+ * registers the worker, called from _PG_init while
+ * shared_preload_libraries is processed
+ */
+void pp_register_worker(void) {
+  BackgroundWorker worker;
+
+  memset(&worker, 0, sizeof(worker));
+  worker.bgw_flags =
+      BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+  /* standbys replaying the changes load the tables before promotion */
+  worker.bgw_start_time = passWalLogChanges ? BgWorkerStart_ConsistentState
+                                            : BgWorkerStart_RecoveryFinished;
+  worker.bgw_restart_time = 10;
+  snprintf(worker.bgw_library_name, BGW_MAXLEN, "passwordpolicy");
+  snprintf(worker.bgw_function_name, BGW_MAXLEN, "passwordpolicy_worker_main");
+  snprintf(worker.bgw_name, BGW_MAXLEN, "passwordpolicy worker");
+  snprintf(worker.bgw_type, BGW_MAXLEN, "passwordpolicy worker");
+  RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * pp_shadow_enqueue
+ *
+ * hands the features of a password over to the worker, dropping them if
+ * the queue is full
+ */
+void pp_shadow_enqueue(const PPFeatures *features) {
+  Latch *latch = NULL;
+  bool queued = false;
+
+  if (pp_shared == NULL || !passShadowEnabled) {
+    return;
+  }
+
+  SpinLockAcquire(&pp_shared->queue_lock);
+  if (pp_shared->queue_head - pp_shared->queue_tail < PP_SHADOW_QUEUE_SIZE) {
+    pp_shared->queue[pp_shared->queue_head % PP_SHADOW_QUEUE_SIZE] = *features;
+    pp_shared->queue_head++;
+    latch = pp_shared->worker_latch;
+    queued = true;
+  }
+  SpinLockRelease(&pp_shared->queue_lock);
+
+  if (!queued) {
+    pp_count(PP_COUNTER_SHADOW_DROPPED);
+  } else if (latch != NULL) {
+    SetLatch(latch);
+  }
+}
+
+/*
+ * pp_wake_worker
+ *
+ * sets the latch of the worker, if it is running
+ */
+void pp_wake_worker(void) {
+  Latch *latch;
+
+  SpinLockAcquire(&pp_shared->queue_lock);
+  latch = pp_shared->worker_latch;
+  SpinLockRelease(&pp_shared->queue_lock);
+  if (latch != NULL) {
+    SetLatch(latch);
+  }
+}
+
+static void shadow_policy(PPPolicy *policy) {
+  policy->min_length = passShadowMinLength;
+  policy->min_special = passShadowMinSpcChar;
+  policy->min_numbers = passShadowMinNumChar;
+  policy->min_upper = passShadowMinUpperChar;
+  policy->min_lower = passShadowMinLowerChar;
+  policy->min_distinct = passShadowMinDistinctChar;
+  policy->min_transitions = passShadowMinTransitions;
+  policy->max_repeat_share = passShadowMaxRepeatShare;
+}
+
+/* evaluate everything queued so far against the shadow policy */
+static void shadow_drain(void) {
+  PPFeatures batch[PP_SHADOW_BATCH];
+  PPPolicy policy;
+  int count;
+  int i;
+
+  shadow_policy(&policy);
+
+  do {
+    count = 0;
+    SpinLockAcquire(&pp_shared->queue_lock);
+    while (count < PP_SHADOW_BATCH &&
+           pp_shared->queue_tail < pp_shared->queue_head) {
+      batch[count++] =
+          pp_shared->queue[pp_shared->queue_tail % PP_SHADOW_QUEUE_SIZE];
+      pp_shared->queue_tail++;
+    }
+    SpinLockRelease(&pp_shared->queue_lock);
+
+    for (i = 0; i < count; i++) {
+      PPRule rule = pp_evaluate(&policy, &batch[i]);
+
+      pg_atomic_fetch_add_u64(&pp_shared->shadow_verdicts[rule], 1);
+    }
+  } while (count == PP_SHADOW_BATCH);
+}
+
+/* an empty tier before the denylists are loaded must not replace the dump */
+static void worker_dump(int code, Datum arg) {
+  if (passHotTierDumpInterval > 0 && pp_shared->denylist_loaded) {
+    pp_hot_dump();
+  }
+}
+
+/* loads the denylists and restores their hot tier, once the tables exist */
+static bool load_denylists(void) {
+  if (!pp_denylist_load()) {
+    return false;
+  }
+  pp_hot_restore();
+  return true;
+}
+
+static void worker_shutdown(int code, Datum arg) {
+  SpinLockAcquire(&pp_shared->queue_lock);
+  pp_shared->worker_latch = NULL;
+  SpinLockRelease(&pp_shared->queue_lock);
+}
+
+void passwordpolicy_worker_main(Datum main_arg) {
+  TimestampTz last_promotion;
+  TimestampTz last_dump;
+  TimestampTz last_expiry_scan = 0;
+  bool loaded;
+
+  pqsignal(SIGHUP, SignalHandlerForConfigReload);
+  pqsignal(SIGTERM, die);
+  BackgroundWorkerUnblockSignals();
+
+  on_shmem_exit(worker_shutdown, (Datum)0);
+  SpinLockAcquire(&pp_shared->queue_lock);
+  pp_shared->worker_latch = MyLatch;
+  SpinLockRelease(&pp_shared->queue_lock);
+
+  BackgroundWorkerInitializeConnection(passDatabase, NULL, 0);
+  loaded = load_denylists();
+  pp_age_load();
+  before_shmem_exit(worker_dump, (Datum)0);
+  last_promotion = GetCurrentTimestamp();
+  last_dump = last_promotion;
+
+  for (;;) {
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                    1000L, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+
+    if (ConfigReloadPending) {
+      ConfigReloadPending = false;
+      ProcessConfigFile(PGC_SIGHUP);
+    }
+
+    shadow_drain();
+
+    /* the extension may be created after startup */
+    if (!loaded) {
+      loaded = load_denylists();
+    }
+
+    /* replayed records of the denylists go on top of the tables */
+    if (loaded) {
+      pp_wal_apply();
+    }
+    pp_age_flush();
+    pp_fuzzy_build();
+
+    if (passHotTierInterval > 0 &&
+        TimestampDifferenceExceeds(last_promotion, GetCurrentTimestamp(),
+                                   passHotTierInterval * 1000)) {
+      pp_hot_promote();
+      last_promotion = GetCurrentTimestamp();
+    }
+
+    if (passHotTierDumpInterval > 0 && loaded &&
+        TimestampDifferenceExceeds(last_dump, GetCurrentTimestamp(),
+                                   passHotTierDumpInterval * 1000)) {
+      pp_hot_dump();
+      last_dump = GetCurrentTimestamp();
+    }
+
+    if (passExpiryWarningDays > 0 &&
+        TimestampDifferenceExceeds(last_expiry_scan, GetCurrentTimestamp(),
+                                   passExpiryCheckInterval * 1000)) {
+      pp_expiry_scan();
+      last_expiry_scan = GetCurrentTimestamp();
+    }
+  }
+}
@@ -8,6 +8,56 @@ CREATE USER test_pass WITH PASSWORD 'aaaaaaaa1234';
 
 CREATE USER test_pass WITH PASSWORD 'aaaaaa#*#134';
 
+CREATE USER test_pass WITH PASSWORD 'ASWtest_pass#*#134';
+
 CREATE USER test_pass WITH PASSWORD 'ASWsdf#*#134';
 
+SELECT stage, ran, verdict, bytes_scanned FROM passwordpolicy_explain('aaaaaaaa1234', 'test_pass');
+
+SELECT stage, ran, verdict, bytes_scanned FROM passwordpolicy_explain('ASWsdf#*#134', 'test_pass');
+
+ALTER USER test_pass WITH PASSWORD 'aaaaaaaaAB12#$';
+
+SELECT stage, ran, verdict, bytes_scanned FROM passwordpolicy_explain('Aa1!Aa1!Aa1!', 'test_pass');
+
+SELECT stage, ran, verdict, bytes_scanned FROM passwordpolicy_explain('ASWsdf#*#１３４', 'test_pass');
+
+SELECT stage, ran, verdict, bytes_scanned FROM passwordpolicy_explain('ASWﬁona#*#134', 'fiona');
+
+SELECT stage, ran, verdict, bytes_scanned FROM passwordpolicy_explain('ASWtest_pass#*#134', 'tеst_pass');
+
+ALTER USER test_pass WITH PASSWORD 'ASWｔｅｓｔ_pass#*#134';
+
+SELECT stage, ran, verdict, bytes_scanned FROM passwordpolicy_explain('v_]$q%f=^;H3Y]#;J]h#bXa#138I=8nQO0ynof52r7zcS.8sufdjYH?,/bH5', 'test_pass');
+
+SELECT stage, ran FROM passwordpolicy_explain('$6R,)X9cut5{<aOKTCN|q<jB%M/,xQxXD]5F~5c,3SLSJ/Sm', 'test_pass');
+
+SELECT stage, ran FROM passwordpolicy_explain('MyCompanyGlobexIsTheBest-2024!xyz', 'test_pass');
+
+SELECT stage, ran FROM passwordpolicy_explain('MyCompanyGlobexIsTheBest-2024!xyzQwErTy12ab', 'test_pass');
+
+SELECT kind, password FROM passwordpolicy_corpus(42, 12) WHERE kind <> 'utf8_mix';
+
+SELECT e.verdict, count(*) FROM passwordpolicy_corpus(1, 200) c, passwordpolicy_explain(c.password, 'alice') e WHERE e.stage = 'policy' GROUP BY 1 ORDER BY 1;
+
+SELECT passwordpolicy_deny_add('acme');
+
+SELECT structure, entries_limit FROM passwordpolicy_memory;
+
+SELECT passwordpolicy_unlock('test_pass');
+
+SELECT passwordpolicy_scram_verifier('aaaaaaaa1234', 'test_pass');
+
+SELECT left(passwordpolicy_scram_verifier('ASWsdf#*#134', 'test_pass'), 19) AS verifier;
+
+SELECT * FROM passwordpolicy_provision_roles('[{"role": "test_pass", "password": "ASWsdf#*#134"}, {"role": "svc_a", "password": "short"}]', true);
+
+SELECT * FROM passwordpolicy_provision_roles('[{"role": "test_pass", "password": "ASWsdf#*#134"}, {"role": "svc_a", "password": "short"}]');
+
+SELECT * FROM passwordpolicy_provision_roles('[{"role": "svc_a", "password": "ASWsdf#*#134"}, {"role": "svc_a", "password": "ASWsdf#*#135"}]');
+
+SELECT * FROM passwordpolicy_provision_roles('[{"role": "svc_a", "password": "ASWsdf#*#134"}]');
+
+DROP ROLE svc_a;
+
 DROP USER IF EXISTS test_pass;
\ No newline at end of file
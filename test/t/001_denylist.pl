@@ -0,0 +1,93 @@
+# Copyright (c) 2018, indrajit
+
+# Denylists managed with passwordpolicy_deny_add and _remove, with the
+# module in shared_preload_libraries.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('denylist');
+$node->init;
+$node->append_conf('postgresql.conf',
+	"shared_preload_libraries = 'passwordpolicy'");
+$node->start;
+
+# the worker loads the denylists once the extension exists
+$node->safe_psql('postgres', 'CREATE EXTENSION passwordpolicy');
+$node->poll_query_until('postgres',
+	"SELECT count(*) = 1 FROM passwordpolicy_list_stats")
+  or die "timed out waiting for the denylists to be loaded";
+
+my ($ret, $stdout, $stderr);
+
+is( $node->safe_psql('postgres', "SELECT passwordpolicy_deny_add('Acme')"),
+	't', 'word added');
+is( $node->safe_psql('postgres', "SELECT passwordpolicy_deny_add('acme')"),
+	'f', 'words are folded to lower case');
+is($node->safe_psql('postgres', 'SELECT * FROM passwordpolicy_list_stats'),
+	'default|reject|1|0', 'default list has the word');
+
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"CREATE ROLE dave LOGIN PASSWORD 'ASWaCMe#*#134'");
+like(
+	$stderr,
+	qr/password must not contain denied words/,
+	'password with a denied word rejected');
+
+$node->safe_psql('postgres',
+	"CREATE ROLE dave LOGIN PASSWORD 'ASWsdf#*#134'");
+is($node->safe_psql('postgres', 'SELECT * FROM passwordpolicy_list_stats'),
+	'default|reject|1|1', 'rejection counted as a hit of the list');
+
+# changes only reach the index when their transaction commits
+$node->safe_psql('postgres',
+	"BEGIN; SELECT passwordpolicy_deny_add('sdf'); ROLLBACK;");
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE dave PASSWORD 'ASWsdf#*#135'");
+is($ret, 0, 'word added by a rolled back transaction not denied');
+
+is( $node->safe_psql('postgres', "SELECT passwordpolicy_deny_remove('acme')"),
+	't', 'word removed');
+is( $node->safe_psql('postgres', "SELECT passwordpolicy_deny_remove('acme')"),
+	'f', 'word removed already');
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE dave PASSWORD 'ASWacme#*#134'");
+is($ret, 0, 'removed word no longer denied');
+
+# the index is shared by all databases, but only managed in one
+$node->safe_psql('postgres', 'CREATE DATABASE other');
+$node->safe_psql('other', 'CREATE EXTENSION passwordpolicy');
+($ret, $stdout, $stderr) =
+  $node->psql('other', "SELECT passwordpolicy_deny_add('initech')");
+like(
+	$stderr,
+	qr/passwordpolicy denylists are managed in database "postgres"/,
+	'denylists not managed in other databases');
+
+$node->safe_psql('postgres', "SELECT passwordpolicy_deny_add('initech')");
+($ret, $stdout, $stderr) = $node->psql('other',
+	"ALTER ROLE dave PASSWORD 'ASWinitech#*#134'");
+like(
+	$stderr,
+	qr/password must not contain denied words/,
+	'denied words apply to all databases');
+
+# and the worker loads the words again after a restart
+$node->restart;
+$node->poll_query_until('postgres',
+	"SELECT words = 1 FROM passwordpolicy_list_stats WHERE list = 'default'")
+  or die "timed out waiting for the denylists to be loaded";
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE dave PASSWORD 'ASWinitech#*#134'");
+like(
+	$stderr,
+	qr/password must not contain denied words/,
+	'denied words survive a restart');
+
+$node->stop;
+
+done_testing();
@@ -0,0 +1,103 @@
+# Copyright (c) 2018, indrajit
+
+# Denylists with their own actions, created with passwordpolicy_list_set.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('lists');
+$node->init;
+$node->append_conf('postgresql.conf',
+	"shared_preload_libraries = 'passwordpolicy'");
+$node->start;
+
+$node->safe_psql('postgres', 'CREATE EXTENSION passwordpolicy');
+$node->poll_query_until('postgres',
+	"SELECT count(*) = 1 FROM passwordpolicy_list_stats")
+  or die "timed out waiting for the denylists to be loaded";
+
+my ($ret, $stdout, $stderr);
+
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"SELECT passwordpolicy_list_set('corp', 'block')");
+like(
+	$stderr,
+	qr/denylist action must be "reject" or "warn"/,
+	'unknown action refused');
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"SELECT passwordpolicy_deny_add('globex', 'corp')");
+like($stderr, qr/denylist "corp" does not exist/, 'words need a list');
+
+$node->safe_psql('postgres',
+	"SELECT passwordpolicy_list_set('corp', 'warn')");
+$node->safe_psql('postgres',
+	"SELECT passwordpolicy_deny_add('globex', 'corp')");
+
+# a warn list lets the password through
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"CREATE ROLE erin LOGIN PASSWORD 'ASWglobex#*#134'");
+is($ret, 0, 'password with a word of a warn list accepted');
+like(
+	$stderr,
+	qr/WARNING:  password contains a word of denylist "corp"/,
+	'warn list reported');
+
+is( $node->safe_psql(
+		'postgres',
+		"SELECT verdict, lists FROM passwordpolicy_explain('ASWglobex#*#134', 'erin') WHERE stage = 'denylist'"
+	),
+	'ok|corp',
+	'explain names the list');
+
+# a word in two lists is one entry of the index
+$node->safe_psql('postgres', "SELECT passwordpolicy_deny_add('globex')");
+is( $node->safe_psql(
+		'postgres',
+		"SELECT verdict, lists FROM passwordpolicy_explain('ASWglobex#*#134', 'erin') WHERE stage = 'denylist'"
+	),
+	'denylist|default,corp',
+	'reject list wins over warn list');
+$node->safe_psql('postgres', "SELECT passwordpolicy_deny_remove('globex')");
+
+$node->safe_psql('postgres',
+	"SELECT passwordpolicy_list_set('corp', 'reject')");
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE erin PASSWORD 'ASWglobex#*#135'");
+like(
+	$stderr,
+	qr/password must not contain denied words/,
+	'list changed to reject');
+
+is( $node->safe_psql(
+		'postgres', 'SELECT * FROM passwordpolicy_list_stats ORDER BY list'),
+	"corp|reject|1|2\ndefault|reject|0|0",
+	'words and hits per list');
+
+# the lists and their actions are loaded after a restart
+$node->restart;
+$node->poll_query_until('postgres',
+	"SELECT count(*) = 2 FROM passwordpolicy_list_stats")
+  or die "timed out waiting for the denylists to be loaded";
+is( $node->safe_psql(
+		'postgres', 'SELECT list, action, words FROM passwordpolicy_list_stats ORDER BY list'),
+	"corp|reject|1\ndefault|reject|0",
+	'lists survive a restart');
+
+is( $node->safe_psql('postgres', "SELECT passwordpolicy_list_drop('corp')"),
+	't', 'list dropped');
+is( $node->safe_psql('postgres', "SELECT passwordpolicy_list_drop('corp')"),
+	'f', 'list dropped already');
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE erin PASSWORD 'ASWglobex#*#135'");
+is($ret, 0, 'words of a dropped list no longer denied');
+unlike($stderr, qr/WARNING/, 'dropped list not reported');
+is($node->safe_psql('postgres', 'SELECT list FROM passwordpolicy_list_stats'),
+	'default', 'only the default list is left');
+
+$node->stop;
+
+done_testing();
@@ -0,0 +1,96 @@
+# Copyright (c) 2018, indrajit
+
+# Promotion of frequently matched denylist words into the hot tier.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('hot_tier');
+$node->init;
+$node->append_conf(
+	'postgresql.conf', qq{
+shared_preload_libraries = 'passwordpolicy'
+p_policy.hot_tier_interval = 1
+});
+$node->start;
+
+$node->safe_psql('postgres', 'CREATE EXTENSION passwordpolicy');
+$node->poll_query_until('postgres',
+	"SELECT count(*) = 1 FROM passwordpolicy_list_stats")
+  or die "timed out waiting for the denylists to be loaded";
+
+$node->safe_psql('postgres',
+	"SELECT passwordpolicy_deny_add('acme'), passwordpolicy_deny_add('initech')"
+);
+$node->safe_psql('postgres',
+	"CREATE ROLE frank LOGIN PASSWORD 'ASWsdf#*#134'");
+
+my $tier_query =
+  "SELECT cache_tier FROM passwordpolicy_explain('ASWacme#*#134', 'frank') WHERE stage = 'denylist'";
+is($node->safe_psql('postgres', $tier_query),
+	'shared', 'cold word found in the index');
+
+# the counts halve every second, try the word often enough to stay hot a while
+$node->safe_psql(
+	'postgres', q{
+DO $$
+BEGIN
+  FOR i IN 1..200 LOOP
+    BEGIN
+      ALTER ROLE frank PASSWORD 'ASWacme#*#134';
+    EXCEPTION WHEN invalid_parameter_value THEN
+      NULL;
+    END;
+  END LOOP;
+END
+$$});
+$node->poll_query_until('postgres', $tier_query, 'hot')
+  or die "timed out waiting for the word to be promoted";
+
+is( $node->safe_psql(
+		'postgres',
+		"SELECT cache_tier FROM passwordpolicy_explain('ASWinitech#*#134', 'frank') WHERE stage = 'denylist'"
+	),
+	'shared',
+	'word never tried stays cold');
+
+my ($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE frank PASSWORD 'ASWacme#*#134'");
+like(
+	$stderr,
+	qr/password must not contain denied words/,
+	'hot word rejected');
+is( $node->safe_psql('postgres',
+		"SELECT value > 0 FROM passwordpolicy_counters WHERE name = 'hot_tier'"
+	),
+	't',
+	'rejection by the hot tier counted');
+
+# the worker dumps the tier when it exits and restores it after a restart;
+# no promotions meanwhile, they would age the counts
+$node->append_conf('postgresql.conf', 'p_policy.hot_tier_interval = 0');
+my $log_offset = -s $node->logfile;
+$node->restart;
+$node->wait_for_log(qr/passwordpolicy restored 1 of 1 hot tier words/,
+	$log_offset);
+my $dump = $node->data_dir . '/passwordpolicy.hot';
+ok(-f $dump, 'hot tier dumped');
+unlike(slurp_file($dump), qr/acme/, 'dump has no words');
+is($node->safe_psql('postgres', $tier_query), 'hot', 'hot tier restored');
+
+$node->append_conf('postgresql.conf', 'p_policy.hot_tier_interval = 1');
+$node->reload;
+
+# a changed denylist makes the tier out of date until the next promotion
+$node->safe_psql('postgres', "SELECT passwordpolicy_deny_remove('acme')");
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE frank PASSWORD 'ASWacme#*#134'");
+is($ret, 0, 'removed hot word no longer denied');
+
+$node->stop;
+
+done_testing();
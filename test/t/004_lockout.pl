@@ -0,0 +1,92 @@
+# Copyright (c) 2018, indrajit
+
+# Lockout of roles after failed logins, see p_policy.max_failed_logins.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+if (!$use_unix_sockets)
+{
+	plan skip_all => 'test requires Unix-domain sockets';
+}
+
+my $node = PostgreSQL::Test::Cluster->new('lockout');
+$node->init;
+$node->append_conf(
+	'postgresql.conf', qq{
+shared_preload_libraries = 'passwordpolicy'
+p_policy.max_failed_logins = 3
+});
+$node->start;
+
+$node->safe_psql('postgres', 'CREATE EXTENSION passwordpolicy');
+$node->safe_psql('postgres',
+	"CREATE ROLE grace LOGIN PASSWORD 'ASWsdf#*#134'");
+
+unlink($node->data_dir . '/pg_hba.conf');
+$node->append_conf(
+	'pg_hba.conf', qq{
+local all grace scram-sha-256
+local all all trust
+});
+$node->reload;
+
+my $wrong = $node->connstr('postgres') . ' user=grace password=wrong';
+my $right = $node->connstr('postgres') . " user=grace password='ASWsdf#*#134'";
+
+# a successful login clears the failures
+$node->connect_fails($wrong, "failed login $_",
+	expected_stderr => qr/password authentication failed for user "grace"/)
+  for 1 .. 2;
+$node->connect_ok($right, 'login before the limit');
+$node->connect_fails($wrong, "failed login $_ after a login",
+	expected_stderr => qr/password authentication failed for user "grace"/)
+  for 1 .. 2;
+$node->connect_ok($right, 'failures cleared by a login');
+
+$node->connect_fails($wrong, "failed login $_ before the limit",
+	expected_stderr => qr/password authentication failed for user "grace"/)
+  for 1 .. 2;
+$node->connect_fails(
+	$wrong,
+	'failed login reaching the limit',
+	expected_stderr => qr/password authentication failed for user "grace"/,
+	log_like => [qr/passwordpolicy locked role "grace" after 3 failed logins/]
+);
+
+# the right password fails like a wrong one, only the log tells why
+$node->connect_fails(
+	$right,
+	'locked role refused',
+	expected_stderr => qr/password authentication failed for user "grace"/,
+	log_like => [qr/Role is locked by passwordpolicy until/]);
+is( $node->safe_psql('postgres',
+		"SELECT value FROM passwordpolicy_counters WHERE name = 'locked_logins'"
+	),
+	'1',
+	'locked login counted');
+
+# the role was locked from its address as well
+is($node->safe_psql('postgres', "SELECT passwordpolicy_unlock('grace')"),
+	't', 'role unlocked');
+$node->connect_fails(
+	$right,
+	'role still locked from its address',
+	expected_stderr => qr/password authentication failed for user "grace"/,
+	log_like => [qr/Role is locked by passwordpolicy until/]);
+is( $node->safe_psql('postgres',
+		"SELECT passwordpolicy_unlock('grace', '[local]')"),
+	't',
+	'role unlocked from its address');
+$node->connect_ok($right, 'login after unlocking');
+
+is($node->safe_psql('postgres', "SELECT passwordpolicy_unlock('nobody')"),
+	'f', 'role without failed logins');
+
+$node->stop;
+
+done_testing();
@@ -0,0 +1,77 @@
+# Copyright (c) 2018, indrajit
+
+# Typos of denied words, see p_policy.fuzzy_max_distance.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('fuzzy');
+$node->init;
+$node->append_conf(
+	'postgresql.conf', qq{
+shared_preload_libraries = 'passwordpolicy'
+p_policy.fuzzy_max_distance = 1
+});
+$node->start;
+
+$node->safe_psql('postgres', 'CREATE EXTENSION passwordpolicy');
+$node->poll_query_until('postgres',
+	"SELECT count(*) = 1 FROM passwordpolicy_list_stats")
+  or die "timed out waiting for the denylists to be loaded";
+
+$node->safe_psql('postgres',
+	"SELECT passwordpolicy_deny_add('dragon'), passwordpolicy_deny_add('cat')"
+);
+$node->safe_psql('postgres',
+	"CREATE ROLE heidi LOGIN PASSWORD 'ASWsdf#*#134'");
+
+# the worker builds the trie after the change
+$node->poll_query_until(
+	'postgres', q{
+SELECT t.generation = i.generation
+FROM passwordpolicy_memory t, passwordpolicy_memory i
+WHERE t.structure = 'fuzzy trie' AND i.structure = 'denylist index'})
+  or die "timed out waiting for the trie to be built";
+
+is( $node->safe_psql(
+		'postgres',
+		"SELECT stage, verdict, lists FROM passwordpolicy_explain('ASWdragin#*#134', 'heidi') WHERE stage IN ('denylist', 'fuzzy') ORDER BY stage"
+	),
+	"denylist|ok|\nfuzzy|denylist|default",
+	'typo found by the trie walk only');
+
+my ($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE heidi PASSWORD 'ASWdragin#*#134'");
+like(
+	$stderr,
+	qr/password must not contain denied words/,
+	'password with a typo of a denied word rejected');
+
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE heidi PASSWORD 'ASWdrxgin#*#134'");
+is($ret, 0, 'two edits away accepted');
+
+# a word allows one edit per four characters
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE heidi PASSWORD 'ASWcot#*#134'");
+is($ret, 0, 'short word allows no edit');
+
+# removed words leave the trie with its next build
+$node->safe_psql('postgres', "SELECT passwordpolicy_deny_remove('dragon')");
+$node->poll_query_until(
+	'postgres', q{
+SELECT t.generation = i.generation
+FROM passwordpolicy_memory t, passwordpolicy_memory i
+WHERE t.structure = 'fuzzy trie' AND i.structure = 'denylist index'})
+  or die "timed out waiting for the trie to be built";
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE heidi PASSWORD 'ASWdragin#*#134'");
+is($ret, 0, 'typo of a removed word accepted');
+
+$node->stop;
+
+done_testing();
@@ -0,0 +1,93 @@
+# Copyright (c) 2018, indrajit
+
+# Minimum age of passwords, see p_policy.min_password_age.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('password_age');
+$node->init;
+$node->append_conf(
+	'postgresql.conf', qq{
+shared_preload_libraries = 'passwordpolicy'
+p_policy.min_password_age = 3600
+});
+$node->start;
+
+$node->safe_psql('postgres', 'CREATE EXTENSION passwordpolicy');
+$node->safe_psql(
+	'postgres', q{
+CREATE ROLE ivan LOGIN PASSWORD 'ASWsdf#*#134';
+CREATE ROLE judy LOGIN;
+CREATE FUNCTION set_ivan_password() RETURNS void SECURITY DEFINER
+LANGUAGE plpgsql AS $$
+BEGIN
+  ALTER ROLE ivan PASSWORD 'ASWsdf#*#136';
+END
+$$;
+});
+
+my ($ret, $stdout, $stderr);
+
+# the role changing its own password, not an administrator, must wait
+($ret, $stdout, $stderr) = $node->psql(
+	'postgres',
+	"ALTER ROLE ivan PASSWORD 'ASWsdf#*#135'",
+	extra_params => [ '-U', 'ivan' ]);
+like(
+	$stderr,
+	qr/password must be atleast 3600 seconds old before it is changed/,
+	'own password changed too early');
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"SET ROLE ivan; ALTER ROLE ivan PASSWORD 'ASWsdf#*#135'");
+is($ret, 0, 'administrator changes the password, even as the role');
+($ret, $stdout, $stderr) = $node->psql(
+	'postgres',
+	"SELECT set_ivan_password()",
+	extra_params => [ '-U', 'ivan' ]);
+like(
+	$stderr,
+	qr/password must be atleast 3600 seconds old before it is changed/,
+	'own password changed too early through a security definer function');
+
+# only committed changes count
+$node->safe_psql('postgres',
+	"BEGIN; ALTER ROLE judy PASSWORD 'ASWsdf#*#134'; ROLLBACK;");
+($ret, $stdout, $stderr) = $node->psql(
+	'postgres',
+	"ALTER ROLE judy PASSWORD 'ASWsdf#*#135'",
+	extra_params => [ '-U', 'judy' ]);
+is($ret, 0, 'first password of a role set by itself');
+($ret, $stdout, $stderr) = $node->psql(
+	'postgres',
+	"ALTER ROLE judy PASSWORD 'ASWsdf#*#136'",
+	extra_params => [ '-U', 'judy' ]);
+like(
+	$stderr,
+	qr/password must be atleast 3600 seconds old before it is changed/,
+	'second password set by the role too early');
+
+# the worker writes the changes through to their table and loads them
+$node->poll_query_until('postgres',
+	"SELECT count(*) = 2 FROM passwordpolicy_password_changes WHERE role IN ('ivan', 'judy')"
+) or die "timed out waiting for the password changes to be written";
+my $log_offset = -s $node->logfile;
+$node->restart;
+$node->wait_for_log(qr/passwordpolicy loaded \d+ password changes/,
+	$log_offset);
+($ret, $stdout, $stderr) = $node->psql(
+	'postgres',
+	"ALTER ROLE judy PASSWORD 'ASWsdf#*#136'",
+	extra_params => [ '-U', 'judy' ]);
+like(
+	$stderr,
+	qr/password must be atleast 3600 seconds old before it is changed/,
+	'password age survives a restart');
+
+$node->stop;
+
+done_testing();
@@ -0,0 +1,85 @@
+# Copyright (c) 2018, indrajit
+
+# VALID UNTIL limits and the scan for expiring roles, see
+# p_policy.max_valid_days and p_policy.expiry_warning_days.
+
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('valid_until');
+$node->init;
+$node->append_conf(
+	'postgresql.conf', qq{
+shared_preload_libraries = 'passwordpolicy'
+p_policy.max_valid_days = 30
+p_policy.expiry_warning_days = 7
+p_policy.expiry_check_interval = 1
+});
+$node->start;
+
+$node->safe_psql('postgres', 'CREATE EXTENSION passwordpolicy');
+
+# sets the password of a role, valid for the given number of days
+sub set_password
+{
+	my ($command, $role, $days) = @_;
+
+	return $node->psql(
+		'postgres', qq{
+DO \$\$
+BEGIN
+  EXECUTE format('$command ROLE %I LOGIN PASSWORD %L VALID UNTIL %L',
+                 '$role', 'ASWsdf#*#134', now() + interval '$days days');
+END
+\$\$});
+}
+
+my ($ret, $stdout, $stderr);
+
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"CREATE ROLE kate LOGIN PASSWORD 'ASWsdf#*#134'");
+like(
+	$stderr,
+	qr/password must expire within 30 days/,
+	'password without VALID UNTIL refused');
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"CREATE ROLE kate LOGIN PASSWORD 'ASWsdf#*#134' VALID UNTIL 'infinity'");
+like(
+	$stderr,
+	qr/password must expire within 30 days/,
+	'password valid forever refused');
+($ret, $stdout, $stderr) = set_password('CREATE', 'kate', 40);
+like(
+	$stderr,
+	qr/password must expire within 30 days/,
+	'password valid for too long refused');
+
+($ret, $stdout, $stderr) = set_password('CREATE', 'kate', 10);
+is($ret, 0, 'password valid within the limit accepted');
+
+# without VALID UNTIL, the statement keeps the date the role has
+($ret, $stdout, $stderr) = $node->psql('postgres',
+	"ALTER ROLE kate PASSWORD 'ASWsdf#*#135'");
+is($ret, 0, 'password changed within the current date');
+
+# the worker records the roles expiring soon
+($ret, $stdout, $stderr) = set_password('CREATE', 'leo', 3);
+is($ret, 0, 'password valid for a few days accepted');
+$node->poll_query_until('postgres',
+	'SELECT role FROM passwordpolicy_expiring_roles', 'leo')
+  or die "timed out waiting for the expiring role to be recorded";
+
+# and forgets them once they don't expire soon anymore
+$node->safe_psql('postgres',
+	"ALTER ROLE leo VALID UNTIL 'infinity'");
+$node->poll_query_until('postgres',
+	'SELECT count(*) = 0 FROM passwordpolicy_expiring_roles')
+  or die "timed out waiting for the expiring role to be removed";
+
+$node->stop;
+
+done_testing();